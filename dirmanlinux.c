@@ -1,22 +1,9 @@
-#define _GNU_SOURCE
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <dirent.h>
+#include "drmcore.h"
 #include <ncurses.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <sys/sendfile.h>
-#include <errno.h>
-#include <ctype.h>
-#include <stdarg.h>
+#include <poll.h>
 
 #define MAX_OPTIONS 100000
-#define MAX_PATH 4096
-#define CLIPBOARD_SIZE 1000
-#define PAGE_SIZE 100
-#define MAX_FILTER_LEN 256
+#define KEY_EVENT_TICK (KEY_MAX + 1)
 
 // ERROR HANDLING
 #define CHECK_NULL(ptr, msg) do { if (!(ptr)) { status_error(msg); return 0; } } while(0)
@@ -29,7 +16,7 @@ typedef enum {
     ACTION_COPY, ACTION_MOVE, ACTION_PASTE, ACTION_DELETE,
     ACTION_NEW_FILE, ACTION_NEW_DIR,
     ACTION_SELECT, ACTION_SELECT_ALL, ACTION_SELECT_CLEAR,
-    ACTION_FILTER, ACTION_CLEAR_FILTER,
+    ACTION_FILTER, ACTION_CLEAR_FILTER, ACTION_SEARCH, ACTION_GREP, ACTION_SYNC,
     ACTION_PAGE_UP, ACTION_PAGE_DOWN,
     ACTION_GOTO_TOP, ACTION_GOTO_BOTTOM
 } Action;
@@ -39,34 +26,6 @@ typedef struct {
     Action action;
 } KeyMap;
 
-typedef struct {
-    char name[256];
-    int is_dir;
-    off_t size;
-    int selected;
-    int visible;
-} FileEntry;
-
-typedef struct {
-    char path[MAX_PATH];
-    char name[256];
-    int is_dir;
-    int is_cut;
-    int active;
-} ClipboardItem;
-
-typedef struct {
-    FileEntry *entries;
-    int n_options;
-    int highlight;
-    int page_start;
-    int page_count;
-    char current_dir[MAX_PATH];
-    char filter[MAX_FILTER_LEN];
-    int filter_active;
-    int select_count;
-} AppState;
-
 typedef struct {
     char name[20];
     int border, title, dir, file, highlight, text, status, danger, success, info, warning;
@@ -95,12 +54,6 @@ ColorScheme schemes[] = {
 };
 int num_schemes = 8, current_scheme = 0, color_enabled = 1;
 
-ClipboardItem clipboard[CLIPBOARD_SIZE];
-int clipboard_count = 0;
-AppState app = {0};
-char status_msg[256] = {0};
-int status_is_error = 0;
-
 // ASCII BOX CHARACTERS
 #define CORNER_TL "+"
 #define CORNER_TR "+"
@@ -120,6 +73,7 @@ KeyMap keymap[] = {
     {'c', ACTION_COPY}, {'C', ACTION_COPY},
     {'m', ACTION_MOVE}, {'M', ACTION_MOVE},
     {'p', ACTION_PASTE}, {'P', ACTION_PASTE},
+    {'s', ACTION_SYNC},
     {'r', ACTION_DELETE}, {'R', ACTION_DELETE},
     {'n', ACTION_NEW_FILE},
     {'N', ACTION_NEW_DIR},
@@ -127,6 +81,8 @@ KeyMap keymap[] = {
     {1, ACTION_SELECT_ALL},
     {21, ACTION_SELECT_CLEAR},
     {'/', ACTION_FILTER},
+    {'f', ACTION_SEARCH},
+    {'F', ACTION_GREP},
     {KEY_PPAGE, ACTION_PAGE_UP},
     {KEY_NPAGE, ACTION_PAGE_DOWN},
     {KEY_HOME, ACTION_GOTO_TOP},
@@ -180,34 +136,57 @@ void format_size(off_t size, char *buf, size_t len) {
     else snprintf(buf, len, "%.1f%s", d, u[unit]);
 }
 
-void status_error(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(status_msg, sizeof(status_msg), fmt, args);
-    va_end(args);
-    status_is_error = 1;
+// FRAME MODEL
+// draw_ui() keeps a signature of what each part of the last frame showed
+// (header, every listing row, status line) and repaints only the parts whose
+// signature changed; a cursor move touches two rows. Anything else drawn
+// over the screen goes through screen_erase(), which drops the model so the
+// next frame is built in full. Nothing forces a clear: ncurses sends only
+// the cells that differ from the terminal.
+#define FRAME_SIG_SEED 14695981039346656037ULL
+
+struct {
+    int valid, rows, cols;
+    uint64_t header, status;
+    uint64_t *row;      // per screen row; 0: unknown
+} frame;
+
+static uint64_t frame_sig(uint64_t h, const void *p, size_t n) {
+    const unsigned char *b = p;
+    for (size_t k = 0; k < n; k++) h = (h ^ b[k]) * 1099511628211ULL;
+    return h;
 }
 
-void status_info(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(status_msg, sizeof(status_msg), fmt, args);
-    va_end(args);
-    status_is_error = 0;
+static void frame_reset(int rows, int cols) {
+    uint64_t *r = realloc(frame.row, sizeof(uint64_t) * rows);
+    frame.valid = r != NULL;
+    if (!r) return;
+    frame.row = r;
+    memset(r, 0, sizeof(uint64_t) * rows);
+    frame.rows = rows;
+    frame.cols = cols;
+    frame.header = frame.status = 0;
 }
 
-void status_clear() {
-    status_msg[0] = '\0';
-    status_is_error = 0;
+void screen_erase() {
+    erase();
+    frame.valid = 0;
+}
+
+void frame_flush() {
+    wnoutrefresh(stdscr);
+    doupdate();
 }
 
+// item may hold several lines separated by '\n'
 int confirm_dialog(const char *msg, const char *item) {
-    int ch, sel = 1;
+    int ch, sel = 1, lines = 1;
+    for (const char *p = item; *p; p++) lines += *p == '\n';
     while (1) {
-        clear();
+        screen_erase();
         int my, mx;
         getmaxyx(stdscr, my, mx);
-        int bw = 60, bh = 8;
+        int bw = 60, bh = 7 + lines;
         int sx = (mx-bw)/2, sy = (my-bh)/2;
         
         draw_box(sy, sx, bh, bw, 9);
@@ -215,10 +194,15 @@ int confirm_dialog(const char *msg, const char *item) {
         mvprintw(sy+2, sx+3, "%s", msg);
         if (color_enabled) attroff(COLOR_PAIR(9)|A_BOLD);
         if (color_enabled) attron(COLOR_PAIR(11)|A_BOLD);
-        mvprintw(sy+3, sx+5, "%s", item);
+        const char *p = item;
+        for (int k = 0; k < lines; k++) {
+            const char *e = strchrnul(p, '\n');
+            mvprintw(sy+3+k, sx+5, "%.*s", (int)(e - p < bw - 8 ? e - p : bw - 8), p);
+            p = *e ? e + 1 : e;
+        }
         if (color_enabled) attroff(COLOR_PAIR(11)|A_BOLD);
         
-        int by = sy+5;
+        int by = sy+4+lines;
         if (sel == 0) {
             if (color_enabled) attron(COLOR_PAIR(8));
             mvprintw(by, sx+15, " [ HAYIR ] ");
@@ -247,7 +231,7 @@ int input_dialog(const char *title, char *buf, int max, int is_dir) {
     int ch, pos = 0;
     buf[0] = '\0';
     while (1) {
-        clear();
+        screen_erase();
         int my, mx;
         getmaxyx(stdscr, my, mx);
         int bw = 60, bh = 7;
@@ -283,159 +267,111 @@ int input_dialog(const char *title, char *buf, int max, int is_dir) {
     }
 }
 
+// msg may hold several lines separated by '\n'
 void info_dialog(const char *msg, int success) {
-    clear();
-    int my, mx;
+    screen_erase();
+    int my, mx, lines = 1;
     getmaxyx(stdscr, my, mx);
-    int bw = 50, bh = 5;
+    for (const char *p = msg; *p; p++) lines += *p == '\n';
+    int bw = lines > 1 ? 64 : 50, bh = 4 + lines;
     int sx = (mx-bw)/2, sy = (my-bh)/2;
     draw_box(sy, sx, bh, bw, success ? 10 : 9);
     if (color_enabled) attron(COLOR_PAIR(success ? 10 : 9)|A_BOLD);
-    mvprintw(sy+2, sx+(bw-strlen(msg))/2, "%s", msg);
+    for (int k = 0; k < lines; k++) {
+        const char *e = strchrnul(msg, '\n');
+        int n = e - msg < bw - 4 ? e - msg : bw - 4;
+        mvprintw(sy+2+k, sx+(bw-n)/2, "%.*s", n, msg);
+        msg = *e ? e + 1 : e;
+    }
     if (color_enabled) attroff(COLOR_PAIR(success ? 10 : 9)|A_BOLD);
     refresh();
     getch();
 }
 
-void apply_filter() {
-    app.select_count = 0;
-    for (int i = 0; i < app.n_options; i++) {
-        if (app.filter_active && app.filter[0]) {
-            app.entries[i].visible = (strcasestr(app.entries[i].name, app.filter) != NULL);
-        } else {
-            app.entries[i].visible = 1;
+// Waits for a key while servicing background events. Returns KEY_EVENT_TICK
+// when an event changed what is on screen and the caller should redraw.
+// Wakes once a second to pick up clipboard changes from other instances.
+int read_key() {
+    static int clip_seen = -1;
+    while (1) {
+        nodelay(stdscr, TRUE);
+        int ch = getch();
+        nodelay(stdscr, FALSE);
+        if (ch != ERR) return ch;
+        
+        struct pollfd pfd[3] = {{STDIN_FILENO, POLLIN, 0}, {events.wake_fd, POLLIN, 0}, {app.inotify_fd, POLLIN, 0}};
+        int ready = poll(pfd, app.inotify_fd >= 0 ? 3 : 2, 1000);
+        if (ready < 0 && errno != EINTR) return getch();
+        int changed = 0;
+        if (ready == 0) {
+            int clip_state = clip_count() * 2 + clip_is_cut();
+            changed = clip_state != clip_seen;
+            clip_seen = clip_state;
         }
-        if (app.entries[i].visible && app.entries[i].selected) app.select_count++;
-    }
-    int visible_count = 0;
-    for (int i = 0; i < app.n_options; i++) if (app.entries[i].visible) visible_count++;
-    app.page_count = (visible_count + PAGE_SIZE - 1) / PAGE_SIZE;
-    if (app.page_count == 0) app.page_count = 1;
-    app.page_start = 0;
-    app.highlight = 0;
-}
-
-void* safe_malloc(size_t size, const char *ctx) {
-    void *p = malloc(size);
-    if (!p) {
-        status_error("Bellek yetersiz: %s", ctx);
-        return NULL;
-    }
-    return p;
-}
-
-void* safe_realloc(void *p, size_t size, const char *ctx) {
-    void *np = realloc(p, size);
-    if (!np) {
-        status_error("Bellek yetersiz: %s", ctx);
-        return NULL;
+        if (pfd[1].revents & POLLIN) changed |= process_events();
+        if (app.inotify_fd >= 0 && (pfd[2].revents & POLLIN)) changed |= process_inotify();
+        if (changed) return KEY_EVENT_TICK;
     }
-    return np;
 }
 
-int remove_recursive(const char *path) {
-    struct stat st;
-    if (stat(path, &st) < 0) return -1;
-    if (S_ISDIR(st.st_mode)) {
-        DIR *d = opendir(path);
-        if (!d) return -1;
-        struct dirent *dir;
-        while ((dir = readdir(d)) != NULL) {
-            if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-            char child_path[MAX_PATH];
-            snprintf(child_path, sizeof(child_path), "%s/%s", path, dir->d_name);
-            if (remove_recursive(child_path) < 0) { closedir(d); return -1; }
-        }
-        closedir(d);
-        return rmdir(path);
+// Status box only; progress repaints use this instead of a full draw_ui()
+void draw_status() {
+    int my, mx;
+    getmaxyx(stdscr, my, mx);
+    uint64_t sig = frame_sig(FRAME_SIG_SEED, status_msg, strlen(status_msg));
+    sig = frame_sig(sig, &status_is_error, sizeof(status_is_error));
+    if (frame.valid && sig == frame.status) return;
+    frame.status = sig;
+    mvhline(my-2, 1, ' ', mx - 2);
+    draw_box(my-3, 0, 3, mx, status_is_error ? 9 : 7);
+    if (status_msg[0]) {
+        if (color_enabled) attron(COLOR_PAIR(status_is_error ? 9 : 7)|A_BOLD);
+        mvprintw(my-2, 2, "%.*s", mx - 4, status_msg);
+        if (color_enabled) attroff(COLOR_PAIR(status_is_error ? 9 : 7)|A_BOLD);
     } else {
-        return unlink(path);
+        if (color_enabled) attron(COLOR_PAIR(7));
+        mvprintw(my-2, 2, "c:Copy m:Move p:Paste s:Sync r:Del n:NewF N:NewD Space:Sel A:All U:Clr /:Filt f:Find F:Grep Pg:Page q:Quit");
+        if (color_enabled) attroff(COLOR_PAIR(7));
     }
 }
 
-int load_directory() {
-    if (app.entries) {
-        free(app.entries);
-        app.entries = NULL;
-    }
-    
-    DIR *d = opendir(app.current_dir);
-    if (!d) {
-        status_error("Dizin acilamadi: %s", strerror(errno));
-        return 0;
-    }
-    
-    app.entries = safe_malloc(sizeof(FileEntry) * 1000, "init entries");
-    if (!app.entries) {
-        closedir(d);
-        return 0;
-    }
-    int capacity = 1000;
+static void draw_header(int mx) {
+    char count_str[48];
+    int visible_count = app.n_visible;
+    if (app.searching) snprintf(count_str, sizeof(count_str), "%d found | searching...", visible_count);
+    else if (app.search[0]) snprintf(count_str, sizeof(count_str), "%d found", visible_count);
+    else if (app.loading) snprintf(count_str, sizeof(count_str), "%d files | loading %d...", visible_count, app.st.count);
+    else if (app.load_rate > 0) snprintf(count_str, sizeof(count_str), "%d files | %.0f/s", visible_count, app.load_rate);
+    else snprintf(count_str, sizeof(count_str), "%d files", visible_count);
+    char page_str[32] = "";
+    if (app.page_count > 1) snprintf(page_str, sizeof(page_str), "Page %d/%d", (app.page_start/PAGE_SIZE)+1, app.page_count);
     
-    struct dirent *dir;
-    app.n_options = 0;
-    
-    while ((dir = readdir(d)) != NULL) {
-        if (strcmp(dir->d_name, ".") == 0) continue;
-        
-        if (app.n_options >= capacity) {
-            capacity *= 2;
-            FileEntry *new_entries = safe_realloc(app.entries, sizeof(FileEntry) * capacity, "expand entries");
-            if (!new_entries) {
-                closedir(d);
-                return 0;
-            }
-            app.entries = new_entries;
-        }
-        
-        strncpy(app.entries[app.n_options].name, dir->d_name, 255);
-        app.entries[app.n_options].name[255] = '\0';
-        
-        char full_path[MAX_PATH];
-        snprintf(full_path, sizeof(full_path), "%s/%s", app.current_dir, dir->d_name);
-        
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            app.entries[app.n_options].is_dir = S_ISDIR(st.st_mode);
-            app.entries[app.n_options].size = st.st_size;
-        } else {
-            app.entries[app.n_options].is_dir = 0;
-            app.entries[app.n_options].size = 0;
-        }
-        
-        app.entries[app.n_options].selected = 0;
-        app.entries[app.n_options].visible = 1;
-        app.n_options++;
-    }
-    
-    closedir(d);
-    apply_filter();
-    status_clear();
-    return 1;
-}
-
-void draw_ui() {
-    clear();
-    int my, mx;
-    getmaxyx(stdscr, my, mx);
+    int state[] = {clip_count(), clip_is_cut(), app.select_count, app.filter_active, app.fuzzy,
+                   app.search_content};
+    uint64_t sig = frame_sig(FRAME_SIG_SEED, app.current_dir, strlen(app.current_dir));
+    sig = frame_sig(sig, count_str, strlen(count_str));
+    sig = frame_sig(sig, page_str, strlen(page_str));
+    sig = frame_sig(sig, app.filter, strlen(app.filter));
+    sig = frame_sig(sig, app.search, strlen(app.search));
+    sig = frame_sig(sig, state, sizeof(state));
+    if (sig == frame.header) return;
+    frame.header = sig;
     
+    // The info line writes over the box's bottom edge, so the box goes first
+    mvhline(1, 1, ' ', mx - 2);
     draw_box(0, 0, 3, mx, 1);
     if (color_enabled) attron(COLOR_PAIR(2)|A_BOLD);
-    mvprintw(1, 2, "[ %s ]", app.current_dir);
+    mvprintw(1, 2, "[ %.*s ]", mx - 8 > 0 ? mx - 8 : 0, app.current_dir);
     if (color_enabled) attroff(COLOR_PAIR(2)|A_BOLD);
     
-    char count_str[32];
-    int visible_count = 0;
-    for (int i = 0; i < app.n_options; i++) if (app.entries[i].visible) visible_count++;
-    snprintf(count_str, sizeof(count_str), "%d files", visible_count);
     if (color_enabled) attron(COLOR_PAIR(11));
     mvprintw(1, mx - strlen(count_str) - 3, "%s", count_str);
     if (color_enabled) attroff(COLOR_PAIR(11));
     
     int info_x = 2;
-    if (clipboard_count > 0) {
+    if (clip_count() > 0) {
         if (color_enabled) attron(COLOR_PAIR(12)|A_BOLD);
-        mvprintw(2, info_x, "[CLIP:%d %s]", clipboard_count, clipboard[0].is_cut ? "MV" : "CP");
+        mvprintw(2, info_x, "[CLIP:%d %s]", clip_count(), clip_is_cut() ? "MV" : "CP");
         if (color_enabled) attroff(COLOR_PAIR(12)|A_BOLD);
         info_x += 15;
     }
@@ -445,199 +381,383 @@ void draw_ui() {
         if (color_enabled) attroff(COLOR_PAIR(13)|A_BOLD);
         info_x += 10;
     }
+    if (app.search[0]) {
+        if (color_enabled) attron(COLOR_PAIR(12)|A_BOLD);
+        mvprintw(2, info_x, "[%s:%.*s]", app.search_content ? "GREP" : "FIND", mx / 4, app.search);
+        if (color_enabled) attroff(COLOR_PAIR(12)|A_BOLD);
+    }
     if (app.filter_active) {
         if (color_enabled) attron(COLOR_PAIR(11)|A_BOLD);
-        mvprintw(2, mx - strlen(app.filter) - 10, "[/%s]", app.filter);
+        mvprintw(2, mx - strlen(app.filter) - 10, "[%c%s]", app.fuzzy ? '~' : '/', app.filter);
         if (color_enabled) attroff(COLOR_PAIR(11)|A_BOLD);
     }
-    
-    if (app.page_count > 1) {
-        char page_str[32];
-        snprintf(page_str, sizeof(page_str), "Page %d/%d", (app.page_start/PAGE_SIZE)+1, app.page_count);
-        mvprintw(2, (mx - strlen(page_str))/2, "%s", page_str);
+    if (page_str[0]) mvprintw(2, (mx - strlen(page_str))/2, "%s", page_str);
+}
+
+// One listing row; the last one sits on the box's bottom edge, which is
+// restored when the row is repainted
+static void draw_row(int row, int p, int my, int mx) {
+    int name_width = mx - 20;
+    // Clipped: a name wrapping onto the next row would outlive that row's repaint
+    int name_max = name_width - 8 > 0 ? name_width - 8 : 0;
+    int i = p < 0 ? -1 : app.vis[p];
+    char size_str[10] = "";
+    if (i >= 0) {
+        stat_entry(i);
+        long long du = du_enabled && ENT_IS(i, ENT_DIR) && i < app.du_n ? app.du[i] : -2;
+        if (du >= 0) format_size(du, size_str, sizeof(size_str));
+        else if (du == -1 && app.du_job) strcpy(size_str, "...");
+        else format_size(app.st.size[i], size_str, sizeof(size_str));
     }
     
-    int content_h = my - 6;
-    draw_box(3, 0, content_h, mx, 1);
+    int state[] = {i, p == app.highlight, i >= 0 ? app.st.flags[i] & (ENT_SELECTED|ENT_DIR) : 0};
+    uint64_t sig = frame_sig(FRAME_SIG_SEED, state, sizeof(state));
+    sig = frame_sig(sig, size_str, strlen(size_str));
+    if (i >= 0) sig = frame_sig(sig, ENT_NAME(i), app.st.name_len[i]);
+    if (sig == frame.row[row]) return;
+    frame.row[row] = sig;
     
-    int start_row = 4;
-    int name_width = mx - 20;
+    if (row == my - 4) {
+        if (color_enabled) attron(COLOR_PAIR(1));
+        mvprintw(row, 0, CORNER_BL);
+        for (int k = 0; k < mx - 2; k++) addstr(H_LINE);
+        addstr(CORNER_BR);
+        if (color_enabled) attroff(COLOR_PAIR(1));
+    } else {
+        mvhline(row, 1, ' ', mx - 2);
+    }
+    if (i < 0) return;
     
-    for (int i = 0; i < app.n_options && start_row < my - 3; i++) {
-        if (!app.entries[i].visible) continue;
-        
-        int vis_idx = 0;
-        for (int j = 0; j < i; j++) if (app.entries[j].visible) vis_idx++;
-        if (vis_idx < app.page_start) continue;
-        if (vis_idx >= app.page_start + PAGE_SIZE) break;
-        
-        char size_str[10];
-        format_size(app.entries[i].size, size_str, sizeof(size_str));
-        
-        char sel_mark[4] = "  ";
-        if (app.entries[i].selected) strcpy(sel_mark, "* ");
+    char sel_mark[4] = "  ";
+    if (ENT_IS(i, ENT_SELECTED)) strcpy(sel_mark, "* ");
+    
+    if (p == app.highlight) {
+        if (color_enabled) attron(COLOR_PAIR(8));
+        mvprintw(row, 1, "%s>", sel_mark);
+        mvprintw(row, 4, "%-*s", name_width - 3, "");
+        if (color_enabled) attroff(COLOR_PAIR(8));
         
-        if (i == app.highlight) {
-            if (color_enabled) attron(COLOR_PAIR(8));
-            mvprintw(start_row, 1, "%s>", sel_mark);
-            mvprintw(start_row, 4, "%-*s", name_width - 3, "");
-            if (color_enabled) attroff(COLOR_PAIR(8));
-            
-            if (color_enabled) attron(COLOR_PAIR(8));
-            mvprintw(start_row, 4, "%s %s", app.entries[i].is_dir ? "[DIR]" : "[FIL]", app.entries[i].name);
-            mvprintw(start_row, mx - 10, "%8s", size_str);
-            if (color_enabled) attroff(COLOR_PAIR(8));
-        } else {
-            mvprintw(start_row, 1, "%s ", sel_mark);
-            if (color_enabled) {
-                if (app.entries[i].selected) attron(COLOR_PAIR(13));
-                else attron(COLOR_PAIR(app.entries[i].is_dir ? 3 : 4));
-            }
-            mvprintw(start_row, 4, "%s %s", app.entries[i].is_dir ? "[DIR]" : "[FIL]", app.entries[i].name);
-            if (color_enabled) {
-                if (app.entries[i].selected) attroff(COLOR_PAIR(13));
-                else attroff(COLOR_PAIR(app.entries[i].is_dir ? 3 : 4));
-            }
-            if (color_enabled) attron(COLOR_PAIR(11));
-            mvprintw(start_row, mx - 10, "%8s", size_str);
-            if (color_enabled) attroff(COLOR_PAIR(11));
+        if (color_enabled) attron(COLOR_PAIR(8));
+        mvprintw(row, 4, "%s %.*s", ENT_IS(i, ENT_DIR) ? "[DIR]" : "[FIL]", name_max, ENT_NAME(i));
+        mvprintw(row, mx - 10, "%8s", size_str);
+        if (color_enabled) attroff(COLOR_PAIR(8));
+    } else {
+        mvprintw(row, 1, "%s ", sel_mark);
+        if (color_enabled) {
+            if (ENT_IS(i, ENT_SELECTED)) attron(COLOR_PAIR(13));
+            else attron(COLOR_PAIR(ENT_IS(i, ENT_DIR) ? 3 : 4));
         }
-        start_row++;
+        mvprintw(row, 4, "%s %.*s", ENT_IS(i, ENT_DIR) ? "[DIR]" : "[FIL]", name_max, ENT_NAME(i));
+        if (color_enabled) {
+            if (ENT_IS(i, ENT_SELECTED)) attroff(COLOR_PAIR(13));
+            else attroff(COLOR_PAIR(ENT_IS(i, ENT_DIR) ? 3 : 4));
+        }
+        if (color_enabled) attron(COLOR_PAIR(11));
+        mvprintw(row, mx - 10, "%8s", size_str);
+        if (color_enabled) attroff(COLOR_PAIR(11));
     }
-    
-    draw_box(my-3, 0, 3, mx, status_is_error ? 9 : 7);
-    if (status_msg[0]) {
-        if (color_enabled) attron(COLOR_PAIR(status_is_error ? 9 : 7)|A_BOLD);
-        mvprintw(my-2, 2, "%s", status_msg);
-        if (color_enabled) attroff(COLOR_PAIR(status_is_error ? 9 : 7)|A_BOLD);
-    } else {
-        if (color_enabled) attron(COLOR_PAIR(7));
-        mvprintw(my-2, 2, "c:Copy m:Move p:Paste r:Del n:NewF N:NewD Space:Sel A:All U:Clr /:Filt Pg:Page q:Quit");
-        if (color_enabled) attroff(COLOR_PAIR(7));
+}
+
+void draw_ui() {
+    int my, mx;
+    getmaxyx(stdscr, my, mx);
+    if (!frame.valid || frame.rows != my || frame.cols != mx) {
+        erase();
+        frame_reset(my, mx);
+        draw_box(3, 0, my - 6, mx, 1);
     }
     
-    refresh();
+    draw_header(mx);
+    int p = app.page_start;
+    int page_end = app.page_start + PAGE_SIZE;
+    if (page_end > app.n_visible) page_end = app.n_visible;
+    for (int row = 4; row < my - 3; row++, p++) draw_row(row, p < page_end ? p : -1, my, mx);
+    
+    draw_status();
+    frame_flush();
 }
 
 void filter_mode() {
     app.filter_active = 1;
     app.filter[0] = '\0';
+    apply_filter();
     int pos = 0;
     int ch;
     
     while (1) {
-        snprintf(status_msg, sizeof(status_msg), "Filter: %s_", app.filter);
+        snprintf(status_msg, sizeof(status_msg), "%s: %s_   (Tab: %s)", app.fuzzy ? "Fuzzy" : "Filter",
+                 app.filter, app.fuzzy ? "substring" : "fuzzy");
         status_is_error = 0;
         draw_ui();
         
-        ch = getch();
+        ch = read_key();
         
-        if (ch == 27) {
+        if (ch == KEY_EVENT_TICK) {
+            continue;
+        } else if (ch == 27) {
             app.filter_active = 0;
             app.filter[0] = '\0';
             status_clear();
             apply_filter();
             return;
         } else if (ch == 10) {
+            filter_history_clear();
             status_clear();
             return;
+        } else if (ch == '\t') {
+            app.fuzzy = !app.fuzzy;
+            apply_filter();
         } else if (ch == KEY_BACKSPACE || ch == 127 || ch == '\b') {
-            if (pos > 0) app.filter[--pos] = '\0';
+            if (pos > 0) {
+                app.filter[--pos] = '\0';
+                filter_widen();
+            }
         } else if (pos < MAX_FILTER_LEN-1 && ch >= 32 && ch < 127) {
             app.filter[pos++] = ch;
             app.filter[pos] = '\0';
+            filter_narrow();
         }
-        apply_filter();
     }
 }
 
-int copy_file(const char *src, const char *dst) {
-    int fd_src = open(src, O_RDONLY);
-    if (fd_src < 0) return -1;
-    struct stat st;
-    fstat(fd_src, &st);
-    int fd_dst = open(dst, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode);
-    if (fd_dst < 0) { close(fd_src); return -1; }
-    
-    off_t offset = 0;
-    ssize_t sent = sendfile(fd_dst, fd_src, &offset, st.st_size);
-    close(fd_src);
-    close(fd_dst);
-    return (sent == st.st_size) ? 0 : -1;
+static void paste_progress(const CopyStats *cs) {
+    char done[16], total[16], rate[16];
+    format_size(cs->bytes, done, sizeof(done));
+    format_size(cs->total_bytes, total, sizeof(total));
+    format_size((off_t)cs->bytes_per_sec, rate, sizeof(rate));
+    if (cs->measuring) {
+        snprintf(status_msg, sizeof(status_msg), "Hesaplaniyor: %ld dosya, %s...", cs->total_files, total);
+    } else {
+        int pct = cs->total_bytes > 0 ? (int)(cs->bytes * 100 / cs->total_bytes) : 0;
+        char eta[16] = "--:--";
+        if (cs->eta >= 0) snprintf(eta, sizeof(eta), "%d:%02d", (int)cs->eta / 60, (int)cs->eta % 60);
+        char verified[32] = "";
+        if (copy_verify) snprintf(verified, sizeof(verified), " (%ld dogrulandi)", cs->verified);
+        int len = snprintf(status_msg, sizeof(status_msg), "%s / %s (%d%%) | %s/s | %ld/%ld dosya%s | ETA %s",
+                           done, total, pct > 100 ? 100 : pct, rate, cs->files, cs->total_files, verified, eta);
+        // The current file gets whatever room is left, cut at the end
+        int room = (int)sizeof(status_msg) - len - 4;
+        if (len > 0 && room > 0) snprintf(status_msg + len, sizeof(status_msg) - len, " | %.*s", room, cs->current);
+    }
+    status_is_error = 0;
+    draw_status();
+    frame_flush();
 }
 
-int copy_dir_recursive(const char *src, const char *dst) {
-    struct stat st;
-    if (stat(src, &st) < 0) return -1;
-    if (mkdir(dst, st.st_mode) < 0 && errno != EEXIST) return -1;
-    
-    DIR *d = opendir(src);
-    if (!d) return -1;
-    
-    struct dirent *dir;
-    while ((dir = readdir(d)) != NULL) {
-        if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-        
-        char src_p[MAX_PATH], dst_p[MAX_PATH];
-        snprintf(src_p, sizeof(src_p), "%s/%s", src, dir->d_name);
-        snprintf(dst_p, sizeof(dst_p), "%s/%s", dst, dir->d_name);
-        
-        struct stat s;
-        if (stat(src_p, &s) == 0) {
-            if (S_ISDIR(s.st_mode)) {
-                if (copy_dir_recursive(src_p, dst_p) < 0) { closedir(d); return -1; }
-            } else {
-                if (copy_file(src_p, dst_p) < 0) { closedir(d); return -1; }
-            }
-        }
+// Names every copy that did not read back identical (a moved one kept its source); returns how many
+static int verify_report(const EntryStore *bad) {
+    if (bad->count == 0) return 0;
+    char msg[1024];
+    size_t cut = strcmp(app.current_dir, "/") ? strlen(app.current_dir) + 1 : 1;
+    int len = snprintf(msg, sizeof(msg), "%d dosya dogrulanamadi:", bad->count);
+    for (int i = 0; i < bad->count && i < 8; i++) {
+        const char *path = bad->names + bad->name_off[i];
+        len += snprintf(msg + len, sizeof(msg) - len, "\n%s", strlen(path) > cut ? path + cut : path);
     }
-    closedir(d);
-    return 0;
+    if (bad->count > 8) snprintf(msg + len, sizeof(msg) - len, "\n... ve %d dosya daha", bad->count - 8);
+    info_dialog(msg, 0);
+    return bad->count;
 }
 
-void execute_batch(int is_cut) {
-    if (clipboard_count == 0) {
-        status_error("Clipboard bos!");
-        return;
+static int dst_cmp(const void *a, const void *b, void *ctx) {
+    char **dsts = ctx;
+    int x = *(const int *)a, y = *(const int *)b, c = strcmp(dsts[x], dsts[y]);
+    return c ? c : x - y;
+}
+
+// Pastes the shared clipboard into the current directory; 0 if there was nothing to paste
+int execute_batch() {
+    EntryStore clip = {0};
+    int is_cut = clip_snapshot(&clip);
+    if (is_cut < 0 || clip.count == 0) {
+        status_error(is_cut < 0 ? "Clipboard okunamadi" : "Clipboard bos!");
+        store_free(&clip);
+        return 0;
     }
     
-    int success = 0, fail = 0;
+    int success = 0, fail = 0, n = 0;
+    const char **srcs = malloc(clip.count * sizeof(char *));
+    char **dsts = malloc(clip.count * sizeof(char *));
+    int *order = malloc(clip.count * sizeof(int));
+    if (!srcs || !dsts || !order) {
+        free(srcs);
+        free(dsts);
+        free(order);
+        store_free(&clip);
+        status_error("Bellek yetersiz");
+        return 0;
+    }
     
-    for (int i = 0; i < clipboard_count; i++) {
-        snprintf(status_msg, sizeof(status_msg), "[%d/%d] %s...", i+1, clipboard_count, clipboard[i].name);
-        status_is_error = 0;
-        draw_ui();
-        refresh();
-        
+    for (int i = 0; i < clip.count; i++) {
+        char *src = clip.names + clip.name_off[i];
+        const char *name = strrchr(src, '/') ? strrchr(src, '/') + 1 : src;
         char dst[MAX_PATH];
-        snprintf(dst, sizeof(dst), "%s/%s", app.current_dir, clipboard[i].name);
+        int dlen = snprintf(dst, sizeof(dst), "%s/%s", strcmp(app.current_dir, "/") ? app.current_dir : "", name);
+        if (dlen < 0 || dlen >= (int)sizeof(dst)) { fail++; continue; }
         
-        if (strcmp(clipboard[i].path, dst) == 0) continue;
+        if (strcmp(src, dst) == 0) continue;
         
         struct stat st;
         if (stat(dst, &st) == 0) {
             char msg[512];
-            snprintf(msg, sizeof(msg), "'%s' uzerine yazilsin mi?", clipboard[i].name);
+            snprintf(msg, sizeof(msg), "'%s' uzerine yazilsin mi?", name);
             if (!confirm_dialog("Dosya var", msg)) continue;
         }
         
-        int res;
-        if (clipboard[i].is_dir) {
-            if (is_cut) res = rename(clipboard[i].path, dst);
-            else res = copy_dir_recursive(clipboard[i].path, dst);
-        } else {
-            if (is_cut) res = rename(clipboard[i].path, dst);
-            else res = copy_file(clipboard[i].path, dst);
+        if (is_cut) {
+            if (rename(src, dst) == 0) { success++; continue; }
+            // Across filesystems the copier moves it instead
+            if (errno != EXDEV) { fail++; continue; }
         }
-        
-        if (res == 0) success++;
+        // A directory pasted inside itself would copy forever
+        size_t len = clip.name_len[i];
+        if ((clip.flags[i] & ENT_DIR) && strncmp(dst, src, len) == 0 && dst[len] == '/') {
+            fail++;
+            continue;
+        }
+        srcs[n] = src;
+        dsts[n] = strdup(dst);
+        if (dsts[n]) n++;
         else fail++;
     }
     
-    if (is_cut) clipboard_count = 0;
+    // Same-named entries from different directories would land on one
+    // destination: the first is pasted, the rest fail
+    for (int i = 0; i < n; i++) order[i] = i;
+    qsort_r(order, n, sizeof(int), dst_cmp, dsts);
+    int kept = 0;
+    for (int k = 0; k < n; k++) {
+        if (k > 0 && strcmp(dsts[order[k]], dsts[order[k - 1]]) == 0) { free(dsts[order[k]]); dsts[order[k]] = NULL; fail++; }
+    }
+    for (int i = 0; i < n; i++) {
+        if (!dsts[i]) continue;
+        srcs[kept] = srcs[i];
+        dsts[kept++] = dsts[i];
+    }
+    n = kept;
+    
+    CopyStats cs = {0};
+    EntryStore bad = {0};
+    if (n > 0) {
+        snprintf(status_msg, sizeof(status_msg), "%d oge %s (%d is parcacigi)...", n, is_cut ? "tasiniyor" : "kopyalaniyor", copy_worker_count());
+        status_is_error = 0;
+        draw_ui();
+        
+        int *failed = calloc(n, sizeof(int));
+        if (failed) {
+            int flags = (is_cut ? COPY_MOVE : 0) | (copy_verify ? COPY_VERIFY : 0);
+            copy_tree(srcs, (const char **)dsts, n, flags, failed, &cs, paste_progress, &bad);
+            for (int i = 0; i < n; i++) failed[i] ? fail++ : success++;
+            free(failed);
+        } else {
+            fail += n;
+        }
+    }
+    for (int i = 0; i < n; i++) free(dsts[i]);
+    free(srcs);
+    free(dsts);
+    free(order);
+    store_free(&clip);
     
-    if (fail == 0) status_info("%d oge islemdi", success);
+    if (is_cut) clip_clear();
+    
+    if (verify_report(&bad)) {
+        status_error("%d basari, %d basarisiz | %ld dosya dogrulanamadi", success, fail, cs.mismatched);
+        store_free(&bad);
+        return 1;
+    }
+    store_free(&bad);
+    
+    if (fail == 0 && n > 0 && copy_verify) status_info("%d oge islemdi, %ld dosya dogrulandi | %.1f MB/s", success, cs.verified, cs.bytes_per_sec / 1048576.0);
+    else if (fail == 0 && n > 0) status_info("%d oge islemdi | %.1f MB/s, %.0f dosya/s", success, cs.bytes_per_sec / 1048576.0, cs.files_per_sec);
+    else if (fail == 0) status_info("%d oge islemdi", success);
     else status_info("%d basari, %d basarisiz", success, fail);
+    return 1;
+}
+
+static void sync_progress(const SyncStats *ss) {
+    char hashed[16];
+    format_size(ss->hashed_bytes, hashed, sizeof(hashed));
+    snprintf(status_msg, sizeof(status_msg), "Karsilastiriliyor: %ld ayni, %ld yeni, %ld degisen, %ld fazla%s%s",
+             ss->same, ss->added, ss->changed, ss->extra, ss->hashed_bytes ? " | hash " : "", ss->hashed_bytes ? hashed : "");
+    status_is_error = 0;
+    draw_status();
+    frame_flush();
+}
+
+// Syncs the clipboard into the current directory: each entry is compared
+// with its namesake here and only what differs is copied, after one
+// summary. Returns 0 if nothing changed.
+int execute_sync() {
+    EntryStore clip = {0};
+    int is_cut = clip_snapshot(&clip);
+    SyncPlan *plans = is_cut >= 0 && clip.count > 0 ? calloc(clip.count, sizeof(SyncPlan)) : NULL;
+    if (!plans) {
+        status_error(is_cut < 0 ? "Clipboard okunamadi" : clip.count == 0 ? "Clipboard bos!" : "Bellek yetersiz");
+        store_free(&clip);
+        return 0;
+    }
+    
+    int n = 0, unread = 0, work = 0;
+    SyncStats tot = {0};
+    for (int i = 0; i < clip.count; i++) {
+        char *src = clip.names + clip.name_off[i];
+        const char *name = strrchr(src, '/') ? strrchr(src, '/') + 1 : src;
+        char dst[MAX_PATH];
+        int dlen = snprintf(dst, sizeof(dst), "%s/%s", strcmp(app.current_dir, "/") ? app.current_dir : "", name);
+        if (dlen < 0 || dlen >= (int)sizeof(dst)) { unread++; continue; }
+        size_t len = clip.name_len[i];
+        if (strcmp(src, dst) == 0 || (strncmp(dst, src, len) == 0 && dst[len] == '/')) continue;
+        
+        SyncPlan *p = &plans[n++];
+        if (sync_plan(src, dst, sync_flags, p, sync_progress) < 0) unread++;
+        tot.added += p->stats.added;
+        tot.dirs_added += p->stats.dirs_added;
+        tot.added_bytes += p->stats.added_bytes;
+        tot.changed += p->stats.changed;
+        tot.changed_bytes += p->stats.changed_bytes;
+        tot.same += p->stats.same;
+        tot.extra += p->stats.extra;
+        tot.dirs_extra += p->stats.dirs_extra;
+        tot.extra_bytes += p->stats.extra_bytes;
+        work += p->copy.count + p->replace.count + ((sync_flags & SYNC_DELETE) ? p->extra.count : 0);
+    }
+    store_free(&clip);
+    
+    int done = 0;
+    if (work == 0) {
+        if (unread) status_error("Karsilastirma eksik: %d oge okunamadi", unread);
+        else status_info("Hedef guncel: %ld dosya ayni", tot.same);
+    } else {
+        char summary[512], added[16], changed[16], extra[16];
+        format_size(tot.added_bytes, added, sizeof(added));
+        format_size(tot.changed_bytes, changed, sizeof(changed));
+        format_size(tot.extra_bytes, extra, sizeof(extra));
+        int len = snprintf(summary, sizeof(summary),
+                           "Yeni:    %ld dosya, %ld dizin (%s)\nDegisen: %ld dosya (%s)\nAyni:    %ld dosya\nFazla:   %ld dosya, %ld dizin (%s) %s",
+                           tot.added, tot.dirs_added, added, tot.changed, changed, tot.same,
+                           tot.extra, tot.dirs_extra, extra, (sync_flags & SYNC_DELETE) ? "silinecek" : "kalacak");
+        if (unread) snprintf(summary + len, sizeof(summary) - len, "\n%d oge okunamadi", unread);
+        if (confirm_dialog((sync_flags & SYNC_HASH) ? "Senkronize edilsin mi? (hash)" : "Senkronize edilsin mi?", summary)) {
+            int failed = 0;
+            long files = 0;
+            CopyStats cs = {0};
+            EntryStore bad = {0};
+            for (int i = 0; i < n; i++) {
+                failed += sync_apply(&plans[i], copy_verify ? COPY_VERIFY : 0, &cs, paste_progress, &bad);
+                files += cs.files;
+            }
+            if (verify_report(&bad)) status_error("Senkronize: %d basarisiz | %d dosya dogrulanamadi", failed, bad.count);
+            else if (failed) status_error("Senkronize: %d basarisiz", failed);
+            else status_info("Senkronize: %ld dosya aktarildi (%ld ayni)%s", files, tot.same,
+                             (sync_flags & SYNC_DELETE) && tot.extra + tot.dirs_extra ? ", fazlalar silindi" : "");
+            store_free(&bad);
+            done = 1;
+        }
+    }
+    for (int i = 0; i < n; i++) sync_plan_free(&plans[i]);
+    free(plans);
+    return done;
 }
 
 Action get_action(int ch) {
@@ -649,15 +769,15 @@ Action get_action(int ch) {
 
 void bios_style_menu() {
     MenuTab current_tab = TAB_COLORS;
-    int color_highlight = 0;
+    int color_highlight = 0, sort_highlight = sort_mode;
     int ch;
     const char *color_names[] = {"Default", "Ocean", "Forest", "Sunset", "Matrix", "Mono", "Gold", "Purple"};
     
     while (1) {
-        clear();
+        screen_erase();
         int my, mx;
         getmaxyx(stdscr, my, mx);
-        int box_w = 60, box_h = 20;
+        int box_w = 60, box_h = 24;
         int sx = (mx - box_w) / 2, sy = (my - box_h) / 2;
         
         draw_box(sy, sx, box_h, box_w, 1);
@@ -720,6 +840,69 @@ void bios_style_menu() {
                 break;
                 
             case TAB_VIEW:
+                if (color_enabled) attron(COLOR_PAIR(2) | A_BOLD);
+                mvprintw(content_y, sx + 4, "Sort by:");
+                if (color_enabled) attroff(COLOR_PAIR(2) | A_BOLD);
+                
+                for (int i = 0; i < NUM_SORTS; i++) {
+                    int row = content_y + 2 + i;
+                    if (i == sort_highlight) {
+                        if (color_enabled) attron(COLOR_PAIR(8));
+                        mvprintw(row, sx + 4, ">>");
+                        if (color_enabled) attroff(COLOR_PAIR(8));
+                    } else mvprintw(row, sx + 4, "  ");
+                    
+                    if (i == sort_mode) {
+                        if (color_enabled) attron(COLOR_PAIR(10));
+                        mvprintw(row, sx + 7, "* ");
+                        if (color_enabled) attroff(COLOR_PAIR(10));
+                    } else mvprintw(row, sx + 7, "  ");
+                    
+                    if (i == sort_highlight) attron(A_BOLD);
+                    mvprintw(row, sx + 10, "%s", sort_names[i]);
+                    if (i == sort_highlight) attroff(A_BOLD);
+                }
+                if (color_enabled) attron(COLOR_PAIR(6));
+                mvprintw(content_y + 3 + NUM_SORTS, sx + 4, "[%c] Directories first", sort_dirs_first ? 'x' : ' ');
+                mvprintw(content_y + 4 + NUM_SORTS, sx + 4, "[%c] Directory sizes", du_enabled ? 'x' : ' ');
+                mvprintw(content_y + 5 + NUM_SORTS, sx + 4, "[%c] Sync deletes extra (e)", (sync_flags & SYNC_DELETE) ? 'x' : ' ');
+                mvprintw(content_y + 6 + NUM_SORTS, sx + 4, "[%c] Sync by hash (c)", (sync_flags & SYNC_HASH) ? 'x' : ' ');
+                if (color_enabled) attroff(COLOR_PAIR(6));
+                
+                if (color_enabled) attron(COLOR_PAIR(2) | A_BOLD);
+                mvprintw(content_y, sx + 32, "Listing cache:");
+                if (color_enabled) attroff(COLOR_PAIR(2) | A_BOLD);
+                if (color_enabled) attron(COLOR_PAIR(6));
+                mvprintw(content_y + 2, sx + 34, "%d dirs, %.1f / %zu MB", dir_cache.count,
+                         dir_cache.bytes / 1048576.0, CACHE_MEM_CAP >> 20);
+                mvprintw(content_y + 3, sx + 34, "%lu hits, %lu misses", dir_cache.hits, dir_cache.misses);
+                if (color_enabled) attroff(COLOR_PAIR(6));
+                
+                if (color_enabled) attron(COLOR_PAIR(2) | A_BOLD);
+                mvprintw(content_y + 5, sx + 32, "Copy workers:");
+                if (color_enabled) attroff(COLOR_PAIR(2) | A_BOLD);
+                if (color_enabled) attron(COLOR_PAIR(6));
+                mvprintw(content_y + 5, sx + 46, "%d %s", copy_worker_count(), copy_workers ? "" : "(auto)");
+                mvprintw(content_y + 6, sx + 34, "[%c] verify (v)", copy_verify ? 'x' : ' ');
+                if (color_enabled) attroff(COLOR_PAIR(6));
+                
+                if (color_enabled) attron(COLOR_PAIR(2) | A_BOLD);
+                mvprintw(content_y + 7, sx + 32, "Find:");
+                if (color_enabled) attroff(COLOR_PAIR(2) | A_BOLD);
+                if (color_enabled) attron(COLOR_PAIR(6));
+                if (search_depth) mvprintw(content_y + 8, sx + 34, "depth %d", search_depth);
+                else mvprintw(content_y + 8, sx + 34, "depth any");
+                mvprintw(content_y + 9, sx + 34, "skip %.19s", search_skip[0] ? search_skip : "-");
+                if (app.index_job) mvprintw(content_y + 10, sx + 34, "indexing...");
+                else mvprintw(content_y + 10, sx + 34, "%d index", index_count());
+                if (color_enabled) attroff(COLOR_PAIR(6));
+                
+                mvprintw(content_y + 12, sx + 4, "--------------------------------------");
+                if (color_enabled) attron(COLOR_PAIR(11));
+                mvprintw(content_y + 13, sx + 4, "Enter:Sort d:Dirs s:Sizes +-0:Workers []:Depth k:Skip i:Index");
+                if (color_enabled) attroff(COLOR_PAIR(11));
+                break;
+                
             case TAB_KEYS:
                 if (color_enabled) attron(COLOR_PAIR(11));
                 mvprintw(content_y + 5, sx + 15, "... Coming soon ...");
@@ -750,52 +933,95 @@ void bios_style_menu() {
             case 27: init_colors(); return;
             case KEY_LEFT: if (current_tab > 0) current_tab--; break;
             case KEY_RIGHT: case '\t': current_tab = (current_tab + 1) % NUM_TABS; break;
-            case KEY_UP: if (current_tab == TAB_COLORS && color_highlight > 0) color_highlight--; break;
-            case KEY_DOWN: if (current_tab == TAB_COLORS && color_highlight < 7) color_highlight++; break;
+            case KEY_UP:
+                if (current_tab == TAB_COLORS && color_highlight > 0) color_highlight--;
+                if (current_tab == TAB_VIEW && sort_highlight > 0) sort_highlight--;
+                break;
+            case KEY_DOWN:
+                if (current_tab == TAB_COLORS && color_highlight < 7) color_highlight++;
+                if (current_tab == TAB_VIEW && sort_highlight < NUM_SORTS - 1) sort_highlight++;
+                break;
+            case 'd':
+                if (current_tab == TAB_VIEW) {
+                    sort_dirs_first = !sort_dirs_first;
+                    resort_listing(1);
+                }
+                break;
+            case 's': if (current_tab == TAB_VIEW) du_toggle(); break;
+            case 'v': if (current_tab == TAB_VIEW) copy_verify = !copy_verify; break;
+            case 'e': if (current_tab == TAB_VIEW) sync_flags ^= SYNC_DELETE; break;
+            case 'c': if (current_tab == TAB_VIEW) sync_flags ^= SYNC_HASH; break;
+            case '+': if (current_tab == TAB_VIEW && copy_worker_count() < 64) copy_workers = copy_worker_count() + 1; break;
+            case '-': if (current_tab == TAB_VIEW && copy_worker_count() > 1) copy_workers = copy_worker_count() - 1; break;
+            case '0': if (current_tab == TAB_VIEW) copy_workers = 0; break;
+            case '[': if (current_tab == TAB_VIEW && search_depth > 0) search_depth--; break;
+            case ']': if (current_tab == TAB_VIEW && search_depth < 64) search_depth++; break;
+            case 'k':
+                if (current_tab == TAB_VIEW) {
+                    char buf[SEARCH_SKIP_LEN];
+                    // A lone space clears the list
+                    if (input_dialog("Aramada atlanacak dizinler (virgulle):", buf, sizeof(buf), 1)) {
+                        snprintf(search_skip, sizeof(search_skip), "%s", strcmp(buf, " ") ? buf : "");
+                    }
+                }
+                break;
+            case 'i': if (current_tab == TAB_VIEW) index_refresh(app.current_dir); break;
             case 10: case ' ':
                 if (current_tab == TAB_COLORS) {
                     current_scheme = color_highlight;
                     color_enabled = 1;
                     init_colors();
+                } else if (current_tab == TAB_VIEW && sort_highlight != sort_mode) {
+                    sort_mode = sort_highlight;
+                    resort_listing(1);
                 }
                 break;
         }
     }
 }
 
+// Search results are paths below the current directory; this is the last component
+static const char *ent_base(int i) {
+    const char *slash = strrchr(ENT_NAME(i), '/');
+    return slash ? slash + 1 : ENT_NAME(i);
+}
+
+// Opens the directory holding a search result, with the cursor on it
+static void search_jump(int i) {
+    const char *name = ENT_NAME(i), *slash = strrchr(name, '/');
+    char dir[MAX_PATH];
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - name) : 1, slash ? name : ".");
+    snprintf(app.jump, sizeof(app.jump), "%s", ent_base(i));
+    if (chdir(dir) == 0) {
+        getcwd(app.current_dir, sizeof(app.current_dir));
+        if (!load_directory()) app.jump[0] = '\0';
+    } else {
+        app.jump[0] = '\0';
+        status_error("Dizin acilamadi");
+    }
+}
+
+// Bytes an entry frees when deleted; -1 for a directory whose size is not known yet
+static long long entry_bytes(int i) {
+    if (!ENT_IS(i, ENT_DIR)) {
+        stat_entry(i);
+        return app.st.size[i];
+    }
+    return du_enabled && i < app.du_n && app.du[i] >= 0 ? app.du[i] : -1;
+}
+
 void handle_action(Action act) {
     switch (act) {
-        case ACTION_UP: {
-            for (int i = app.highlight - 1; i >= 0; i--) {
-                if (app.entries[i].visible) {
-                    app.highlight = i;
-                    int vis_idx = 0;
-                    for (int j = 0; j < i; j++) if (app.entries[j].visible) vis_idx++;
-                    if (vis_idx < app.page_start) {
-                        app.page_start -= PAGE_SIZE;
-                        if (app.page_start < 0) app.page_start = 0;
-                    }
-                    break;
-                }
-            }
+        case ACTION_UP:
+            if (app.highlight > 0) move_cursor(app.highlight - 1);
             break;
-        }
-        case ACTION_DOWN: {
-            for (int i = app.highlight + 1; i < app.n_options; i++) {
-                if (app.entries[i].visible) {
-                    app.highlight = i;
-                    int vis_idx = 0;
-                    for (int j = 0; j < i; j++) if (app.entries[j].visible) vis_idx++;
-                    if (vis_idx >= app.page_start + PAGE_SIZE) {
-                        app.page_start += PAGE_SIZE;
-                    }
-                    break;
-                }
-            }
+        case ACTION_DOWN:
+            if (app.highlight + 1 < app.n_visible) move_cursor(app.highlight + 1);
             break;
-        }
         case ACTION_LEFT:
-            if (chdir("..") == 0) {
+            if (app.search[0]) {
+                load_directory();
+            } else if (chdir("..") == 0) {
                 getcwd(app.current_dir, sizeof(app.current_dir));
                 load_directory();
             } else {
@@ -803,9 +1029,12 @@ void handle_action(Action act) {
             }
             break;
         case ACTION_RIGHT:
-        case ACTION_ENTER:
-            if (app.n_options > 0 && app.entries[app.highlight].is_dir) {
-                if (chdir(app.entries[app.highlight].name) == 0) {
+        case ACTION_ENTER: {
+            int idx = cur_index();
+            if (idx >= 0 && app.search[0]) {
+                search_jump(idx);
+            } else if (idx >= 0 && ENT_IS(idx, ENT_DIR)) {
+                if (chdir(ENT_NAME(idx)) == 0) {
                     getcwd(app.current_dir, sizeof(app.current_dir));
                     load_directory();
                 } else {
@@ -813,10 +1042,12 @@ void handle_action(Action act) {
                 }
             }
             break;
+        }
         case ACTION_SELECT: {
-            if (app.n_options == 0) break;
-            app.entries[app.highlight].selected = !app.entries[app.highlight].selected;
-            if (app.entries[app.highlight].selected) app.select_count++;
+            int idx = cur_index();
+            if (idx < 0) break;
+            app.st.flags[idx] ^= ENT_SELECTED;
+            if (ENT_IS(idx, ENT_SELECTED)) app.select_count++;
             else app.select_count--;
             handle_action(ACTION_DOWN);
             break;
@@ -824,96 +1055,87 @@ void handle_action(Action act) {
         case ACTION_SELECT_ALL: {
             int all_selected = (app.select_count > 0);
             app.select_count = 0;
-            for (int i = 0; i < app.n_options; i++) {
-                if (app.entries[i].visible) {
-                    app.entries[i].selected = !all_selected;
-                    if (app.entries[i].selected) app.select_count++;
-                }
+            for (int p = 0; p < app.n_visible; p++) {
+                if (all_selected) app.st.flags[app.vis[p]] &= ~ENT_SELECTED;
+                else app.st.flags[app.vis[p]] |= ENT_SELECTED;
+                if (!all_selected) app.select_count++;
             }
             status_info(all_selected ? "Secim temizlendi" : "Tumu secildi");
             break;
         }
         case ACTION_SELECT_CLEAR: {
-            for (int i = 0; i < app.n_options; i++) app.entries[i].selected = 0;
+            for (int i = 0; i < app.st.count; i++) app.st.flags[i] &= ~ENT_SELECTED;
             app.select_count = 0;
             status_info("Secim temizlendi");
             break;
         }
-        case ACTION_COPY: {
-            int added = 0;
-            for (int i = 0; i < app.n_options && clipboard_count < CLIPBOARD_SIZE; i++) {
-                if (app.entries[i].selected || i == app.highlight) {
-                    int dup = 0;
-                    for (int j = 0; j < clipboard_count; j++) {
-                        if (strcmp(clipboard[j].name, app.entries[i].name) == 0) { dup = 1; break; }
-                    }
-                    if (!dup) {
-                        snprintf(clipboard[clipboard_count].path, MAX_PATH, "%s/%s", app.current_dir, app.entries[i].name);
-                        strncpy(clipboard[clipboard_count].name, app.entries[i].name, 256);
-                        clipboard[clipboard_count].is_dir = app.entries[i].is_dir;
-                        clipboard[clipboard_count].is_cut = 0;
-                        clipboard[clipboard_count].active = 1;
-                        clipboard_count++;
-                        added++;
-                    }
-                }
-            }
-            for (int i = 0; i < app.n_options; i++) app.entries[i].selected = 0;
-            app.select_count = 0;
-            status_info("%d oge kopyalandi", added);
-            break;
-        }
+        case ACTION_COPY:
         case ACTION_MOVE: {
-            int new_count = 0;
-            for (int i = 0; i < clipboard_count; i++) {
-                if (!clipboard[i].is_cut) clipboard[new_count++] = clipboard[i];
-            }
-            clipboard_count = new_count;
-            
-            int added = 0;
-            for (int i = 0; i < app.n_options && clipboard_count < CLIPBOARD_SIZE; i++) {
-                if (app.entries[i].selected || i == app.highlight) {
-                    snprintf(clipboard[clipboard_count].path, MAX_PATH, "%s/%s", app.current_dir, app.entries[i].name);
-                    strncpy(clipboard[clipboard_count].name, app.entries[i].name, 256);
-                    clipboard[clipboard_count].is_dir = app.entries[i].is_dir;
-                    clipboard[clipboard_count].is_cut = 1;
-                    clipboard[clipboard_count].active = 1;
-                    clipboard_count++;
-                    added++;
-                }
+            int cut = act == ACTION_MOVE, cur = cur_index();
+            EntryStore paths = {0};
+            char path[MAX_PATH];
+            for (int i = 0; i < app.st.count; i++) {
+                if (!ENT_IS(i, ENT_SELECTED) && i != cur) continue;
+                int len = snprintf(path, sizeof(path), "%s/%s", strcmp(app.current_dir, "/") ? app.current_dir : "", ENT_NAME(i));
+                if (len >= (int)sizeof(path) || store_push(&paths, path, len, app.st.flags[i] & ENT_DIR) < 0) break;
             }
-            for (int i = 0; i < app.n_options; i++) app.entries[i].selected = 0;
+            int added = clip_add(&paths, cut);
+            store_free(&paths);
+            for (int i = 0; i < app.st.count; i++) app.st.flags[i] &= ~ENT_SELECTED;
             app.select_count = 0;
-            status_info("%d oge tasinmaya hazir", added);
+            if (added < 0) status_error("Clipboard yazilamadi");
+            else status_info(cut ? "%d oge tasinmaya hazir" : "%d oge kopyalandi", added);
             break;
         }
         case ACTION_PASTE:
-            if (clipboard_count == 0) {
-                status_error("Clipboard bos!");
-            } else {
-                execute_batch(clipboard[0].is_cut);
-                load_directory();
-            }
+            if (execute_batch()) refresh_listing();
+            break;
+        case ACTION_SYNC:
+            if (execute_sync()) refresh_listing();
             break;
         case ACTION_DELETE: {
-            int del_count = 0;
-            for (int i = 0; i < app.n_options; i++) {
-                if (app.entries[i].selected || i == app.highlight) {
-                    char msg[512], item[300];
-                    snprintf(msg, sizeof(msg), "Silmek istediginize emin misiniz?");
-                    snprintf(item, sizeof(item), "%s %s", app.entries[i].is_dir ? "[DIR]" : "[FIL]", app.entries[i].name);
-                    
-                    if (confirm_dialog(msg, item)) {
-                        char path[MAX_PATH];
-                        snprintf(path, sizeof(path), "%s/%s", app.current_dir, app.entries[i].name);
-                        if (remove_recursive(path) == 0) del_count++;
-                    }
+            if (app.deleting) { status_error("Silme devam ediyor"); break; }
+            int cur = cur_index(), files = 0, dirs = 0, unknown = 0, top[3] = {-1, -1, -1};
+            long long total = 0, top_size[3] = {0};
+            EntryStore items = {0};
+            for (int i = 0; i < app.st.count; i++) {
+                if (ENT_IS(i, ENT_DELETED) || (!ENT_IS(i, ENT_SELECTED) && i != cur)) continue;
+                if (strcmp(ENT_NAME(i), "..") == 0) continue;   // the cursor may sit on the parent link
+                if (store_push(&items, ENT_NAME(i), app.st.name_len[i], 0) < 0) break;
+                long long size = entry_bytes(i);
+                if (ENT_IS(i, ENT_DIR)) dirs++;
+                else files++;
+                if (size < 0) { unknown++; continue; }
+                total += size;
+                for (int k = 0; k < 3; k++) {
+                    if (top[k] >= 0 && size <= top_size[k]) continue;
+                    for (int j = 2; j > k; j--) { top[j] = top[j - 1]; top_size[j] = top_size[j - 1]; }
+                    top[k] = i;
+                    top_size[k] = size;
+                    break;
                 }
             }
-            if (del_count > 0) {
-                status_info("%d oge silindi", del_count);
-                load_directory();
+            if (items.count == 0) { store_free(&items); break; }
+            
+            // One confirmation covers every entry: counts, total and the largest ones
+            char msg[64], summary[1024], size_str[32];
+            if (unknown == items.count) snprintf(size_str, sizeof(size_str), "?");
+            else format_size(total, size_str, sizeof(size_str));
+            snprintf(msg, sizeof(msg), "%d oge silinsin mi?", items.count);
+            int len = snprintf(summary, sizeof(summary), "%d dosya, %d dizin | %s%s", files, dirs, unknown && total ? "en az " : "", size_str);
+            if (unknown) len += snprintf(summary + len, sizeof(summary) - len, "\n%d dizinin boyutu bilinmiyor", unknown);
+            for (int k = 0; k < 3 && top[k] >= 0 && items.count > 1; k++) {
+                format_size(top_size[k], size_str, sizeof(size_str));
+                len += snprintf(summary + len, sizeof(summary) - len, "\n%s %8s  %.40s", k ? "          " : "En buyuk: ", size_str, ENT_NAME(top[k]));
+            }
+            if (items.count == 1)
+                snprintf(summary + len, sizeof(summary) - len, "\n%s %.45s", dirs ? "[DIR]" : "[FIL]", items.names);
+            if (confirm_dialog(msg, summary)) {
+                delete_start(&items);
+                for (int i = 0; i < app.st.count; i++) app.st.flags[i] &= ~ENT_SELECTED;
+                app.select_count = 0;
             }
+            store_free(&items);
             break;
         }
         case ACTION_NEW_FILE: {
@@ -922,7 +1144,7 @@ void handle_action(Action act) {
                 char path[MAX_PATH];
                 snprintf(path, sizeof(path), "%s/%s", app.current_dir, buf);
                 FILE *f = fopen(path, "w");
-                if (f) { fclose(f); status_info("Dosya olusturuldu"); load_directory(); }
+                if (f) { fclose(f); status_info("Dosya olusturuldu"); refresh_listing(); }
                 else status_error("Dosya olusturulamadi");
             }
             break;
@@ -932,7 +1154,7 @@ void handle_action(Action act) {
             if (input_dialog("Yeni Klasor:", buf, sizeof(buf), 1)) {
                 char path[MAX_PATH];
                 snprintf(path, sizeof(path), "%s/%s", app.current_dir, buf);
-                if (mkdir(path, 0755) == 0) { status_info("Klasor olusturuldu"); load_directory(); }
+                if (mkdir(path, 0755) == 0) { status_info("Klasor olusturuldu"); refresh_listing(); }
                 else status_error("Klasor olusturulamadi");
             }
             break;
@@ -940,43 +1162,47 @@ void handle_action(Action act) {
         case ACTION_FILTER:
             filter_mode();
             break;
+        case ACTION_SEARCH: {
+            char buf[MAX_FILTER_LEN];
+            if (input_dialog("Alt dizinlerde ara (*?[ ile glob):", buf, sizeof(buf), 0)) search_start(buf);
+            break;
+        }
+        case ACTION_GREP: {
+            char buf[MAX_FILTER_LEN];
+            const char *prompt = app.select_count ? "Secili ogelerin iceriginde ara:" : "Dosya iceriklerinde ara:";
+            if (input_dialog(prompt, buf, sizeof(buf), 0)) grep_start(buf);
+            break;
+        }
         case ACTION_PAGE_UP:
-            if (app.page_start >= PAGE_SIZE) {
-                app.page_start -= PAGE_SIZE;
-                int vis = 0;
-                for (int i = 0; i < app.n_options; i++) {
-                    if (!app.entries[i].visible) continue;
-                    if (vis == app.page_start) { app.highlight = i; break; }
-                    vis++;
-                }
-            }
+            if (app.page_start >= PAGE_SIZE) move_cursor(app.page_start - PAGE_SIZE);
             break;
         case ACTION_PAGE_DOWN:
-            if (app.page_start + PAGE_SIZE < app.n_options) {
-                app.page_start += PAGE_SIZE;
-                int vis = 0;
-                for (int i = 0; i < app.n_options; i++) {
-                    if (!app.entries[i].visible) continue;
-                    if (vis == app.page_start) { app.highlight = i; break; }
-                    vis++;
-                }
-            }
+            if (app.page_start + PAGE_SIZE < app.n_visible) move_cursor(app.page_start + PAGE_SIZE);
             break;
         case ACTION_GOTO_TOP:
-            app.page_start = 0;
-            for (int i = 0; i < app.n_options; i++) {
-                if (app.entries[i].visible) { app.highlight = i; break; }
-            }
+            move_cursor(0);
             break;
         case ACTION_GOTO_BOTTOM:
-            app.page_start = (app.page_count - 1) * PAGE_SIZE;
-            for (int i = app.n_options - 1; i >= 0; i--) {
-                if (app.entries[i].visible) { app.highlight = i; break; }
-            }
+            move_cursor(app.n_visible - 1);
             break;
         case ACTION_QUIT:
+            if (app.deleting && !confirm_dialog("Silme devam ediyor", "Yine de cikilsin mi?")) break;
             endwin();
-            if (app.entries) free(app.entries);
+            load_cancel();
+            name_index_free();
+            store_free(&app.st);
+            cache_clear();
+            free(app.vis);
+            free(app.order);
+            free(app.name_key);
+            free(app.name_order);
+            du_cancel();
+            free(app.du);
+            search_cancel();
+            index_cancel();
+            index_close_all();
+            clip_close();
+            if (app.dir_fd >= 0) close(app.dir_fd);
             exit(0);
             break;
         default:
@@ -992,6 +1218,12 @@ int main() {
     cbreak();
     keypad(stdscr, TRUE);
     init_colors();
+    filter_engine_init();
+    if (!events_init()) {
+        endwin();
+        fprintf(stderr, "eventfd olusturulamadi\n");
+        return 1;
+    }
     
     if (!load_directory()) {
         endwin();
@@ -1001,16 +1233,18 @@ int main() {
     
     while (1) {
         draw_ui();
-        int ch = getch();
+        int ch = read_key();
         
-        if (ch == 27) {
+        if (ch == KEY_EVENT_TICK) {
+            continue;
+        } else if (ch == 27) {
             nodelay(stdscr, TRUE);
             int next = getch();
             nodelay(stdscr, FALSE);
             
             if (next == -1) {
                 bios_style_menu();
-                clear();
+                screen_erase();
             } else {
                 ungetch(next);
             }
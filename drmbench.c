@@ -0,0 +1,515 @@
+// DRMNGR benchmark: builds synthetic trees and times the core engine
+// without a terminal. Prints one JSON document on stdout so results can be
+// compared across releases; progress notes go to stderr.
+//
+//   drmbench [-d dir] [-n flat_files] [-r runs] [-k]
+//
+// -d  where the trees are built (default: a fresh directory under /tmp)
+// -n  entries in the flat directory (default 1000000)
+// -r  repetitions of each timed operation (default 5)
+// -k  keep the trees afterwards
+#include "drmcore.h"
+#include <poll.h>
+#include <sys/resource.h>
+
+#define BENCH_MAX 32
+#define DEEP_LEVELS 1000
+#define SMALL_DIRS 100
+#define SMALL_FILES 200
+#define SMALL_SIZE 4096
+#define SPARSE_FILES 4
+#define SPARSE_SIZE ((off_t)1 << 30)
+#define TEXT_DIRS 20
+#define TEXT_FILES 100
+#define TEXT_SIZE (64 * 1024)
+#define TEXT_BIG ((size_t)64 << 20)
+#define TEXT_BYTES ((long long)TEXT_DIRS * TEXT_FILES * TEXT_SIZE + TEXT_BIG)
+
+typedef struct {
+    const char *name;
+    const char *unit;       // what items counts
+    double *lat;            // per-operation latencies, ms
+    int n, cap;
+    double ms;
+    long long items;
+    long peak_rss_kb;
+} Bench;
+
+Bench benches[BENCH_MAX];
+int n_benches = 0;
+
+// Formats a path below the bench tree into buf (MAX_PATH bytes); a -d
+// directory too long for that ends the run rather than truncating paths
+__attribute__((format(printf, 2, 3)))
+static char *tree_path(char *buf, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, MAX_PATH, fmt, ap);
+    va_end(ap);
+    if (n < 0 || n >= MAX_PATH) {
+        fprintf(stderr, "path too long: %s...\n", buf);
+        exit(1);
+    }
+    return buf;
+}
+
+static long peak_rss_kb() {
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+}
+
+static Bench *bench_begin(const char *name, const char *unit) {
+    if (n_benches == BENCH_MAX) return NULL;
+    Bench *b = &benches[n_benches++];
+    *b = (Bench){name, unit};
+    fprintf(stderr, "  %s...\n", name);
+    return b;
+}
+
+static void bench_add(Bench *b, double ms, long long items) {
+    if (!b) return;
+    if (b->n == b->cap) {
+        int cap = b->cap ? b->cap * 2 : 64;
+        double *l = realloc(b->lat, sizeof(double) * cap);
+        if (!l) return;
+        b->lat = l;
+        b->cap = cap;
+    }
+    b->lat[b->n++] = ms;
+    b->ms += ms;
+    b->items += items;
+    b->peak_rss_kb = peak_rss_kb();
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *v, int n, double p) {
+    if (n == 0) return 0;
+    int k = (int)(p * (n - 1) + 0.5);
+    return v[k];
+}
+
+// SYNTHETIC TREES
+// Everything is created relative to directory fds, so the deep tree is not
+// limited by PATH_MAX.
+static int write_file_at(int dir_fd, const char *name, const char *data, size_t len) {
+    int fd = openat(dir_fd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    int r = len && write(fd, data, len) != (ssize_t)len ? -1 : 0;
+    close(fd);
+    return r;
+}
+
+static int open_subdir(int dir_fd, const char *name) {
+    if (mkdirat(dir_fd, name, 0755) < 0 && errno != EEXIST) return -1;
+    return openat(dir_fd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+}
+
+// Names mix digit runs, case and extensions so sorting and filtering see realistic keys
+static int make_flat(int root, int n) {
+    int fd = open_subdir(root, "flat");
+    if (fd < 0) return -1;
+    // "properties" is longer than the 7 extension bytes in a sort key, so
+    // the extension sort also has to finish its ties by name
+    const char *ext[] = {"txt", "c", "h", "jpg", "tar.gz", "log", "md", "properties", ""};
+    int n_ext = sizeof(ext) / sizeof(ext[0]);
+    char name[64];
+    for (int i = 0; i < n; i++) {
+        const char *e = ext[i % n_ext];
+        snprintf(name, sizeof(name), "%s_%d%s%s", i % 3 ? "file" : "Report", i, e[0] ? "." : "", e);
+        if (write_file_at(fd, name, NULL, 0) < 0) { close(fd); return -1; }
+        if (i % 50 == 0) {
+            snprintf(name, sizeof(name), "dir_%d", i);
+            mkdirat(fd, name, 0755);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int make_deep(int root, int levels) {
+    char data[SMALL_SIZE];
+    memset(data, 'd', sizeof(data));
+    int fd = open_subdir(root, "deep");
+    for (int i = 0; fd >= 0 && i < levels; i++) {
+        if (write_file_at(fd, "leaf", data, sizeof(data)) < 0) break;
+        int next = open_subdir(fd, "d");
+        close(fd);
+        fd = next;
+    }
+    if (fd < 0) return -1;
+    close(fd);
+    return 0;
+}
+
+static int make_small(int root) {
+    char data[SMALL_SIZE], name[32];
+    for (size_t k = 0; k < sizeof(data); k++) data[k] = (char)(k * 31);
+    int fd = open_subdir(root, "small");
+    if (fd < 0) return -1;
+    for (int d = 0; d < SMALL_DIRS; d++) {
+        snprintf(name, sizeof(name), "d%03d", d);
+        int dfd = open_subdir(fd, name);
+        if (dfd < 0) { close(fd); return -1; }
+        for (int f = 0; f < SMALL_FILES; f++) {
+            snprintf(name, sizeof(name), "f%04d.dat", f);
+            write_file_at(dfd, name, data, sizeof(data));
+        }
+        close(dfd);
+    }
+    close(fd);
+    return 0;
+}
+
+// Log-like lines for content search: many small files and one large one
+static int make_text(int root) {
+    static const char line[] = "2024-01-01 12:00:00 INFO worker started, queue depth nominal\n";
+    size_t big = TEXT_BIG;
+    char *data = malloc(big);
+    if (!data) return -1;
+    for (size_t k = 0; k < big; k++) data[k] = line[k % (sizeof(line) - 1)];
+    char name[32];
+    int fd = open_subdir(root, "text");
+    if (fd < 0) { free(data); return -1; }
+    for (int d = 0; d < TEXT_DIRS; d++) {
+        snprintf(name, sizeof(name), "t%02d", d);
+        int dfd = open_subdir(fd, name);
+        if (dfd < 0) { close(fd); free(data); return -1; }
+        for (int f = 0; f < TEXT_FILES; f++) {
+            snprintf(name, sizeof(name), "log%03d.txt", f);
+            write_file_at(dfd, name, data, TEXT_SIZE);
+        }
+        close(dfd);
+    }
+    int rc = write_file_at(fd, "big.log", data, big);
+    close(fd);
+    free(data);
+    return rc;
+}
+
+// Mostly holes with a data extent every 256 MB
+static int make_sparse(int root) {
+    char data[1 << 20], name[32];
+    memset(data, 's', sizeof(data));
+    int fd = open_subdir(root, "sparse");
+    if (fd < 0) return -1;
+    for (int i = 0; i < SPARSE_FILES; i++) {
+        snprintf(name, sizeof(name), "huge%d.img", i);
+        int f = openat(fd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if (f < 0 || ftruncate(f, SPARSE_SIZE) < 0) { if (f >= 0) close(f); close(fd); return -1; }
+        for (off_t off = 0; off < SPARSE_SIZE; off += (off_t)256 << 20) {
+            if (pwrite(f, data, sizeof(data), off) < 0) break;
+        }
+        close(f);
+    }
+    close(fd);
+    return 0;
+}
+
+// BENCHMARKS
+static void pump_events() {
+    while (app.loading || app.searching || app.du_job || app.index_job) {
+        struct pollfd pfd = {events.wake_fd, POLLIN, 0};
+        poll(&pfd, 1, 1000);
+        process_events();
+    }
+}
+
+// Full asynchronous scan, merge and sort, as when entering a directory
+static void bench_load(const char *dir, int runs) {
+    Bench *b = bench_begin("load_flat", "entries");
+    snprintf(app.current_dir, sizeof(app.current_dir), "%s", dir);
+    for (int r = 0; r < runs; r++) {
+        double t0 = now_ms();
+        load_directory();
+        pump_events();
+        bench_add(b, now_ms() - t0, app.st.count);
+    }
+}
+
+static void bench_filter(int runs, int fuzzy) {
+    const char *pats[] = {"1", "42", "report", "tar", "zzz"};
+    Bench *b = bench_begin(fuzzy ? "fuzzy_flat" : "filter_flat", "entries");
+    app.filter_active = 1;
+    app.fuzzy = fuzzy;
+    for (int r = 0; r < runs; r++) {
+        for (size_t k = 0; k < sizeof(pats) / sizeof(pats[0]); k++) {
+            snprintf(app.filter, sizeof(app.filter), "%s", pats[k]);
+            double t0 = now_ms();
+            apply_filter();
+            bench_add(b, now_ms() - t0, app.st.count);
+        }
+    }
+    app.filter_active = app.fuzzy = 0;
+    app.filter[0] = '\0';
+    apply_filter();
+}
+
+// First sort of each mode is untimed: it builds the name order and stats
+static void bench_sort(int runs) {
+    Bench *b = bench_begin("sort_flat", "entries");
+    for (int m = 0; m < NUM_SORTS; m++) {
+        sort_mode = m;
+        sort_listing();
+        for (int r = 0; r < runs; r++) {
+            double t0 = now_ms();
+            sort_listing();
+            bench_add(b, now_ms() - t0, app.st.count);
+        }
+    }
+    sort_mode = SORT_NAME;
+}
+
+// Whole synthetic tree, flat directory included
+static void bench_search(const char *root, int runs) {
+    Bench *b = bench_begin("search_tree", "matches");
+    snprintf(app.current_dir, sizeof(app.current_dir), "%s", root);
+    load_directory();
+    pump_events();
+    for (int r = 0; r < runs; r++) {
+        double t0 = now_ms();
+        search_start("42");
+        pump_events();
+        bench_add(b, now_ms() - t0, app.st.count);
+    }
+}
+
+// One build from scratch, then refreshes that find nothing changed and
+// the same search as search_tree answered from the index
+static void bench_index(const char *root, int runs) {
+    Bench *b = bench_begin("index_build", "builds");
+    double t0 = now_ms();
+    if (index_refresh(root)) {
+        pump_events();
+        bench_add(b, now_ms() - t0, 1);
+    }
+    b = bench_begin("index_refresh", "builds");
+    for (int r = 0; r < runs; r++) {
+        t0 = now_ms();
+        if (!index_refresh(root)) break;
+        pump_events();
+        bench_add(b, now_ms() - t0, 1);
+    }
+    b = bench_begin("index_query", "matches");
+    for (int r = 0; r < runs; r++) {
+        t0 = now_ms();
+        search_start("42");
+        pump_events();
+        bench_add(b, now_ms() - t0, app.st.count);
+    }
+}
+
+// A pattern that never matches, so every byte of the text tree is scanned
+static void bench_grep(const char *root, int runs) {
+    Bench *b = bench_begin("grep_text", "bytes");
+    char dir[MAX_PATH];
+    tree_path(dir, "%s/text", root);
+    snprintf(app.current_dir, sizeof(app.current_dir), "%s", dir);
+    load_directory();
+    pump_events();
+    for (int r = 0; r < runs; r++) {
+        double t0 = now_ms();
+        grep_start("zqxjv");
+        pump_events();
+        bench_add(b, now_ms() - t0, TEXT_BYTES);
+    }
+}
+
+static void bench_copy_files(const char *root, const char *dst_root) {
+    char src[MAX_PATH], dst[MAX_PATH];
+    Bench *b = bench_begin("copy_file_small", "files");
+    tree_path(dst, "%s/files", dst_root);
+    mkdir(dst, 0755);
+    for (int f = 0; f < SMALL_FILES; f++) {
+        tree_path(src, "%s/small/d000/f%04d.dat", root, f);
+        tree_path(dst, "%s/files/f%04d.dat", dst_root, f);
+        double t0 = now_ms();
+        if (copy_file(src, dst) == 0) bench_add(b, now_ms() - t0, 1);
+    }
+
+    b = bench_begin("copy_file_sparse", "bytes");
+    for (int i = 0; i < SPARSE_FILES; i++) {
+        tree_path(src, "%s/sparse/huge%d.img", root, i);
+        tree_path(dst, "%s/files/huge%d.img", dst_root, i);
+        double t0 = now_ms();
+        if (copy_file(src, dst) == 0) bench_add(b, now_ms() - t0, SPARSE_SIZE);
+    }
+}
+
+// Each run copies to a fresh destination; bench_remove deletes them afterwards
+static void bench_tree(const char *name, const char *root, const char *tree, const char *dst_root,
+                       long long items, int runs) {
+    char src[MAX_PATH], dst[MAX_PATH];
+    Bench *b = bench_begin(name, "files");
+    tree_path(src, "%s/%s", root, tree);
+    for (int r = 0; r < runs; r++) {
+        tree_path(dst, "%s/%s.%d", dst_root, tree, r);
+        double t0 = now_ms();
+        if (copy_dir_recursive(src, dst) == 0) bench_add(b, now_ms() - t0, items);
+    }
+}
+
+// The text tree copied plain and with COPY_VERIFY, for the cost of reading back
+static void bench_verify(const char *root, const char *dst_root, int runs) {
+    char src[MAX_PATH], dst[MAX_PATH];
+    const char *s = src, *d = dst;
+    tree_path(src, "%s/text", root);
+    for (int verify = 0; verify < 2; verify++) {
+        Bench *b = bench_begin(verify ? "copy_text_verify" : "copy_text", "bytes");
+        for (int r = 0; r < runs; r++) {
+            tree_path(dst, "%s/text.%d", dst_root, r);
+            double t0 = now_ms();
+            int rc = copy_tree(&s, &d, 1, verify ? COPY_VERIFY : 0, NULL, NULL, NULL, NULL);
+            if (rc == 0) bench_add(b, now_ms() - t0, TEXT_BYTES);
+            remove_recursive(dst);
+        }
+    }
+}
+
+static void bench_sync_run(Bench *b, const char *src, const char *dst, long long items) {
+    SyncPlan plan;
+    double t0 = now_ms();
+    int rc = sync_plan(src, dst, 0, &plan, NULL);
+    if (rc == 0 && sync_apply(&plan, 0, NULL, NULL, NULL) == 0) bench_add(b, now_ms() - t0, items);
+    sync_plan_free(&plan);
+}
+
+// The small tree synced into an empty destination, again unchanged, and
+// again after one file per directory was altered at the destination
+static void bench_sync(const char *root, const char *dst_root, int runs) {
+    char src[MAX_PATH], dst[MAX_PATH], path[MAX_PATH];
+    const long long items = SMALL_DIRS * SMALL_FILES;
+    tree_path(src, "%s/small", root);
+    tree_path(dst, "%s/small.sync", dst_root);
+    bench_sync_run(bench_begin("sync_initial", "files"), src, dst, items);
+    Bench *b = bench_begin("sync_unchanged", "files");
+    for (int r = 0; r < runs; r++) bench_sync_run(b, src, dst, items);
+    b = bench_begin("sync_changed", "files");
+    for (int r = 0; r < runs; r++) {
+        for (int d = 0; d < SMALL_DIRS; d++) {
+            tree_path(path, "%s/d%03d/f%04d.dat", dst, d, r % SMALL_FILES);
+            int fd = open(path, O_WRONLY|O_APPEND|O_CLOEXEC);
+            if (fd >= 0 && write(fd, "x", 1) < 0) perror(path);
+            if (fd >= 0) close(fd);
+        }
+        bench_sync_run(b, src, dst, items);
+    }
+    remove_recursive(dst);
+}
+
+static void bench_remove(const char *dst_root, const char **trees, const long long *items, int n, int runs) {
+    char dst[MAX_PATH];
+    Bench *b = bench_begin("remove_tree", "files");
+    for (int k = 0; k < n; k++) {
+        for (int r = 0; r < runs; r++) {
+            tree_path(dst, "%s/%s.%d", dst_root, trees[k], r);
+            double t0 = now_ms();
+            if (remove_recursive(dst) == 0) bench_add(b, now_ms() - t0, items[k]);
+        }
+    }
+}
+
+// A JSON string literal: quotes, backslashes and control bytes escaped
+static void print_json_string(const char *str) {
+    putchar('"');
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') printf("\\%c", *c);
+        else if (*c < 0x20) printf("\\u%04x", *c);
+        else putchar(*c);
+    }
+    putchar('"');
+}
+
+static void print_json(const char *root, int flat_n, int runs, double setup_ms) {
+    printf("{\n  \"tool\": \"drmbench\",\n  \"schema\": 1,\n");
+    printf("  \"cpus\": %d,\n  \"workers\": %d,\n", cpu_count(), copy_worker_count());
+    printf("  \"config\": {\"dir\": ");
+    print_json_string(root);
+    printf(", \"flat_files\": %d, \"runs\": %d, \"deep_levels\": %d, "
+           "\"small_files\": %d, \"sparse_files\": %d, \"sparse_bytes\": %lld, \"text_bytes\": %lld},\n",
+           flat_n, runs, DEEP_LEVELS, SMALL_DIRS * SMALL_FILES, SPARSE_FILES, (long long)SPARSE_SIZE, TEXT_BYTES);
+    printf("  \"setup_seconds\": %.3f,\n  \"benchmarks\": [\n", setup_ms / 1000);
+    for (int k = 0; k < n_benches; k++) {
+        Bench *b = &benches[k];
+        qsort(b->lat, b->n, sizeof(double), cmp_double);
+        double sec = b->ms / 1000;
+        printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %d, \"items\": %lld, \"seconds\": %.6f, "
+               "\"items_per_sec\": %.1f, \"ops_per_sec\": %.1f, "
+               "\"latency_ms\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f}, \"peak_rss_kb\": %ld}%s\n",
+               b->name, b->unit, b->n, b->items, sec,
+               sec > 0 ? b->items / sec : 0, sec > 0 ? b->n / sec : 0,
+               percentile(b->lat, b->n, 0.50), percentile(b->lat, b->n, 0.90),
+               percentile(b->lat, b->n, 0.99), b->n ? b->lat[b->n - 1] : 0,
+               b->peak_rss_kb, k + 1 < n_benches ? "," : "");
+    }
+    printf("  ],\n  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+}
+
+int main(int argc, char **argv) {
+    const char *base = NULL;
+    int flat_n = 1000000, runs = 5, keep = 0, opt;
+    while ((opt = getopt(argc, argv, "d:n:r:k")) != -1) {
+        switch (opt) {
+            case 'd': base = optarg; break;
+            case 'n': flat_n = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 'k': keep = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-d dir] [-n flat_files] [-r runs] [-k]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (runs < 1) runs = 1;
+
+    char root[MAX_PATH], out[MAX_PATH], flat[MAX_PATH], cache[MAX_PATH];
+    tree_path(root, "%s/drmbench.XXXXXX", base ? base : "/tmp");
+    if (!mkdtemp(root)) { perror("mkdtemp"); return 1; }
+    tree_path(out, "%s/out", root);
+    tree_path(flat, "%s/flat", root);
+    tree_path(cache, "%s/cache", root);
+    // Indexes go under the tree, not into the user's cache
+    setenv("XDG_CACHE_HOME", cache, 1);
+    int root_fd = open(root, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (root_fd < 0 || mkdir(out, 0755) < 0 || !events_init()) { perror(root); return 1; }
+    filter_engine_init();
+
+    fprintf(stderr, "building trees in %s\n", root);
+    double t0 = now_ms();
+    if (make_flat(root_fd, flat_n) < 0 || make_deep(root_fd, DEEP_LEVELS) < 0 ||
+        make_small(root_fd) < 0 || make_sparse(root_fd) < 0 || make_text(root_fd) < 0) {
+        perror("building trees");
+        close(root_fd);
+        if (!keep) remove_recursive(root);
+        return 1;
+    }
+    double setup_ms = now_ms() - t0;
+    close(root_fd);
+
+    fprintf(stderr, "running\n");
+    bench_load(flat, runs);
+    bench_filter(runs, 0);
+    bench_filter(runs, 1);
+    bench_sort(runs);
+    bench_search(root, runs);
+    bench_index(root, runs);
+    bench_grep(root, runs);
+    load_cancel();
+    name_index_free();
+    store_free(&app.st);
+
+    bench_copy_files(root, out);
+    const char *trees[] = {"small", "deep"};
+    const long long tree_items[] = {SMALL_DIRS * SMALL_FILES, DEEP_LEVELS};
+    bench_tree("copy_tree_small", root, trees[0], out, tree_items[0], runs);
+    bench_tree("copy_tree_deep", root, trees[1], out, tree_items[1], runs);
+    bench_remove(out, trees, tree_items, 2, runs);
+    bench_verify(root, out, runs);
+    bench_sync(root, out, runs);
+
+    print_json(root, flat_n, runs, setup_ms);
+    if (!keep) remove_recursive(root);
+    return 0;
+}
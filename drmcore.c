@@ -0,0 +1,5787 @@
+#include "drmcore.h"
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/xattr.h>
+#include <sys/file.h>
+#include <fnmatch.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#define DENTS_BUF_SIZE (1 << 20)
+#define DENTS_FIRST_BUF (32 * 1024)
+#define WATCH_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ATTRIB|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+#define ARENA_PAD 64
+#define FUZZY_TOP_K 1000
+#define PARALLEL_MIN_ITEMS 16384
+#define COPY_CHUNK ((size_t)64 << 20)
+#define COPY_SPLIT_MIN ((off_t)256 << 20)
+#define COPY_SPLIT_CHUNK ((off_t)64 << 20)
+#define RW_BUF_SIZE (1 << 20)
+#define VERIFY_ALIGN 4096
+#define VERIFY_DROP_MIN ((off_t)8 << 20)
+#define SEARCH_BATCH 4096
+#define SEARCH_POST_MS 50
+#define SEARCH_SKIP_MAX 32
+
+AppState app = {.dir_fd = -1, .inotify_fd = -1, .watch_wd = -1};
+char status_msg[256] = {0};
+int status_is_error = 0;
+int du_enabled = 0;     // directories show recursive sizes
+int search_depth = 0;   // directory levels searched, 1: the current one only; 0: unlimited
+char search_skip[SEARCH_SKIP_LEN] = ".git,node_modules";    // directories not entered
+
+// STATUS
+// The engine reports through status_msg; the UI shows it, the benchmark ignores it.
+void status_error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(status_msg, sizeof(status_msg), fmt, args);
+    va_end(args);
+    status_is_error = 1;
+}
+
+void status_info(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(status_msg, sizeof(status_msg), fmt, args);
+    va_end(args);
+    status_is_error = 0;
+}
+
+void status_clear() {
+    status_msg[0] = '\0';
+    status_is_error = 0;
+}
+
+// FILTER ENGINE
+// ASCII case-insensitive substring search. Names live in the arena, which
+// keeps ARENA_PAD spare bytes at its tail, so the vector kernels may load
+// past the end of a name without bounds checks.
+typedef const char *(*ci_find_fn)(const char *hay, size_t hlen, const char *needle, size_t nlen);
+
+static inline unsigned char fold_ascii(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+}
+
+static int ci_eq(const char *a, const char *b_lc, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (fold_ascii(a[i]) != (unsigned char)b_lc[i]) return 0;
+    }
+    return 1;
+}
+
+static const char *ci_find_scalar(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return hay;
+    unsigned char first = needle[0];
+    for (size_t i = 0; i + nlen <= hlen; i++) {
+        if (fold_ascii(hay[i]) == first && ci_eq(hay + i + 1, needle + 1, nlen - 1)) return hay + i;
+    }
+    return NULL;
+}
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+
+// Compares first and last needle bytes across a whole vector, then verifies candidates
+static inline __m128i fold16(__m128i v) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static const char *ci_find_sse2(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return hay;
+    if (hlen < nlen) return NULL;
+    __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[nlen - 1]);
+    size_t end = hlen - nlen;
+    for (size_t i = 0; i <= end; i += 16) {
+        __m128i a = fold16(_mm_loadu_si128((const __m128i *)(hay + i)));
+        __m128i b = fold16(_mm_loadu_si128((const __m128i *)(hay + i + nlen - 1)));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        if (end - i < 15) mask &= (2u << (end - i)) - 1;
+        while (mask) {
+            int j = __builtin_ctz(mask);
+            if (nlen <= 2 || ci_eq(hay + i + j + 1, needle + 1, nlen - 2)) return hay + i + j;
+            mask &= mask - 1;
+        }
+    }
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i fold32(__m256i v) {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char *ci_find_avx2(const char *hay, size_t hlen, const char *needle, size_t nlen) {
+    if (nlen == 0) return hay;
+    if (hlen < nlen) return NULL;
+    __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[nlen - 1]);
+    size_t end = hlen - nlen;
+    for (size_t i = 0; i <= end; i += 32) {
+        __m256i a = fold32(_mm256_loadu_si256((const __m256i *)(hay + i)));
+        __m256i b = fold32(_mm256_loadu_si256((const __m256i *)(hay + i + nlen - 1)));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        if (end - i < 31) mask &= (2u << (end - i)) - 1;
+        while (mask) {
+            int j = __builtin_ctz(mask);
+            if (nlen <= 2 || ci_eq(hay + i + j + 1, needle + 1, nlen - 2)) return hay + i + j;
+            mask &= mask - 1;
+        }
+    }
+    return NULL;
+}
+#endif
+
+static ci_find_fn ci_find = ci_find_scalar;
+
+void filter_engine_init() {
+#if defined(__SSE2__)
+    __builtin_cpu_init();
+    ci_find = __builtin_cpu_supports("avx2") ? ci_find_avx2 : ci_find_sse2;
+#endif
+}
+
+static inline int name_matches(int i, const char *lc, size_t n) {
+    return app.st.name_len[i] >= n && ci_find(ENT_NAME(i), app.st.name_len[i], lc, n) != NULL;
+}
+
+// PARALLEL HELPERS
+typedef void (*shard_fn)(void *ctx, int begin, int end, int shard);
+
+typedef struct {
+    shard_fn fn;
+    void *ctx;
+    int begin, end, shard;
+} ShardArg;
+
+static void *shard_thread(void *p) {
+    ShardArg *a = p;
+    a->fn(a->ctx, a->begin, a->end, a->shard);
+    return NULL;
+}
+
+int cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Number of shards parallel_for() will use for n items
+int shard_count(int n) {
+    if (n < PARALLEL_MIN_ITEMS) return 1;
+    int t = cpu_count();
+    if (t > 64) t = 64;
+    if (t > n / (PARALLEL_MIN_ITEMS / 4)) t = n / (PARALLEL_MIN_ITEMS / 4);
+    return t > 0 ? t : 1;
+}
+
+// Splits [0, n) into shard_count(n) contiguous ranges; shard 0 runs on the caller
+void parallel_for(int n, shard_fn fn, void *ctx) {
+    int t = shard_count(n);
+    ShardArg args[64];
+    pthread_t tids[64];
+    int started[64] = {0};
+    for (int s = 0; s < t; s++) {
+        args[s] = (ShardArg){fn, ctx, (int)((long)n * s / t), (int)((long)n * (s + 1) / t), s};
+        if (s > 0) started[s] = pthread_create(&tids[s], NULL, shard_thread, &args[s]) == 0;
+    }
+    fn(ctx, args[0].begin, args[0].end, 0);
+    for (int s = 1; s < t; s++) {
+        if (started[s]) pthread_join(tids[s], NULL);
+        else fn(ctx, args[s].begin, args[s].end, s);
+    }
+}
+
+// WORK POOL
+// Each worker owns a deque: it pushes and pops at the tail (depth-first, warm
+// caches) while idle workers steal from the head of someone else's. Tasks may
+// submit more tasks; pool_wait() returns once every submitted task has run.
+typedef struct Pool Pool;
+typedef void (*task_fn)(Pool *pool, void *arg);
+
+typedef struct {
+    task_fn fn;
+    void *arg;
+} Task;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Task *items;
+    int head, count, cap;
+} TaskDeque;
+
+struct Pool {
+    int n;
+    TaskDeque *dq;
+    pthread_t *tids;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cv, done_cv;
+    atomic_long pending;    // submitted, not yet finished
+    atomic_long queued;     // submitted, not yet started
+    atomic_uint rr;
+    int sleeping, stop;
+};
+
+typedef struct {
+    Pool *pool;
+    int id;
+} PoolWorker;
+
+static __thread Pool *pool_self;
+static __thread int pool_me;
+
+static int deque_push(TaskDeque *q, Task t) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->cap) {
+        int cap = q->cap ? q->cap * 2 : 256;
+        Task *items = malloc(cap * sizeof(Task));
+        if (!items) { pthread_mutex_unlock(&q->lock); return -1; }
+        for (int i = 0; i < q->count; i++) items[i] = q->items[(q->head + i) % q->cap];
+        free(q->items);
+        q->items = items;
+        q->head = 0;
+        q->cap = cap;
+    }
+    q->items[(q->head + q->count++) % q->cap] = t;
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static int deque_take(TaskDeque *q, Task *t, int from_head) {
+    pthread_mutex_lock(&q->lock);
+    int ok = q->count > 0;
+    if (ok) {
+        if (from_head) {
+            *t = q->items[q->head];
+            q->head = (q->head + 1) % q->cap;
+        } else {
+            *t = q->items[(q->head + q->count - 1) % q->cap];
+        }
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static int pool_next(Pool *p, int me, Task *t) {
+    if (deque_take(&p->dq[me], t, 0)) return 1;
+    for (int k = 1; k < p->n; k++)
+        if (deque_take(&p->dq[(me + k) % p->n], t, 1)) return 1;
+    return 0;
+}
+
+static void *pool_worker(void *arg) {
+    PoolWorker *w = arg;
+    Pool *p = w->pool;
+    pool_self = p;
+    pool_me = w->id;
+    free(w);
+    Task t;
+    while (1) {
+        if (atomic_load(&p->queued) > 0 && pool_next(p, pool_me, &t)) {
+            atomic_fetch_sub(&p->queued, 1);
+            t.fn(p, t.arg);
+            if (atomic_fetch_sub(&p->pending, 1) == 1) {
+                pthread_mutex_lock(&p->lock);
+                pthread_cond_broadcast(&p->done_cv);
+                pthread_mutex_unlock(&p->lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        if (p->stop) { pthread_mutex_unlock(&p->lock); break; }
+        if (atomic_load(&p->queued) == 0) {
+            p->sleeping++;
+            pthread_cond_wait(&p->work_cv, &p->lock);
+            p->sleeping--;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+void pool_destroy(Pool *p) {
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->n; i++) {
+        pthread_join(p->tids[i], NULL);
+        pthread_mutex_destroy(&p->dq[i].lock);
+        free(p->dq[i].items);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work_cv);
+    pthread_cond_destroy(&p->done_cv);
+    free(p->dq);
+    free(p->tids);
+    free(p);
+}
+
+Pool *pool_create(int n) {
+    if (n < 1) n = 1;
+    Pool *p = calloc(1, sizeof(Pool));
+    if (!p) return NULL;
+    p->dq = calloc(n, sizeof(TaskDeque));
+    p->tids = calloc(n, sizeof(pthread_t));
+    if (!p->dq || !p->tids) { free(p->dq); free(p->tids); free(p); return NULL; }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work_cv, NULL);
+    pthread_cond_init(&p->done_cv, NULL);
+    for (int i = 0; i < n; i++) pthread_mutex_init(&p->dq[i].lock, NULL);
+    for (int i = 0; i < n; i++) {
+        PoolWorker *w = malloc(sizeof(PoolWorker));
+        if (!w) break;
+        *w = (PoolWorker){p, i};
+        if (pthread_create(&p->tids[i], NULL, pool_worker, w) != 0) { free(w); break; }
+        p->n = i + 1;
+    }
+    if (p->n == 0) { pool_destroy(p); return NULL; }
+    return p;
+}
+
+// Runs the task inline if it cannot be queued, so a submit never loses work
+void pool_submit(Pool *p, task_fn fn, void *arg) {
+    int q = pool_self == p ? pool_me : (int)(atomic_fetch_add(&p->rr, 1) % p->n);
+    atomic_fetch_add(&p->pending, 1);
+    atomic_fetch_add(&p->queued, 1);
+    if (deque_push(&p->dq[q], (Task){fn, arg}) < 0) {
+        atomic_fetch_sub(&p->queued, 1);
+        fn(p, arg);
+        atomic_fetch_sub(&p->pending, 1);
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    if (p->sleeping) pthread_cond_signal(&p->work_cv);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Waits up to timeout_ms (< 0: forever); 1 once the pool has drained
+int pool_wait(Pool *p, int timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000; }
+    pthread_mutex_lock(&p->lock);
+    while (atomic_load(&p->pending) > 0) {
+        if (timeout_ms < 0) pthread_cond_wait(&p->done_cv, &p->lock);
+        else if (pthread_cond_timedwait(&p->done_cv, &p->lock, &ts) == ETIMEDOUT) break;
+    }
+    int done = atomic_load(&p->pending) == 0;
+    pthread_mutex_unlock(&p->lock);
+    return done;
+}
+
+// FUZZY MATCHER
+// Subsequence match; the window is tightened backwards from the first
+// complete match, then scored for boundaries and contiguity. -1: no match.
+int fuzzy_score(const char *s, int n, const char *pat, int m) {
+    if (m == 0) return 0;
+    if (n < m) return -1;
+    int pi = 0, end = -1;
+    for (int i = 0; i < n; i++) {
+        if (fold_ascii(s[i]) == (unsigned char)pat[pi] && ++pi == m) { end = i; break; }
+    }
+    if (end < 0) return -1;
+    int start = 0;
+    pi = m - 1;
+    for (int i = end; i >= 0; i--) {
+        if (fold_ascii(s[i]) == (unsigned char)pat[pi] && --pi < 0) { start = i; break; }
+    }
+    int score = 0, run = 0;
+    pi = 0;
+    for (int i = start; i <= end; i++) {
+        if (pi < m && fold_ascii(s[i]) == (unsigned char)pat[pi]) {
+            int bonus = 0;
+            if (i == 0) bonus = 12;
+            else if (strchr("/_-. ", s[i-1])) bonus = 10;
+            else if (islower((unsigned char)s[i-1]) && isupper((unsigned char)s[i])) bonus = 8;
+            score += 16 + bonus + 6 * run;
+            run++;
+            pi++;
+        } else {
+            score -= 2;
+            run = 0;
+        }
+    }
+    score -= start < 10 ? start : 10;
+    return score;
+}
+
+typedef struct { int score, idx; } Ranked;
+
+// True when a ranks below b: lower score, then later entry
+static inline int ranked_worse(const Ranked *a, const Ranked *b) {
+    return a->score < b->score || (a->score == b->score && a->idx > b->idx);
+}
+
+static void topk_push(Ranked *heap, int *n, int k, Ranked r) {
+    int i;
+    if (*n < k) {
+        i = (*n)++;
+        while (i > 0 && ranked_worse(&r, &heap[(i-1)/2])) { heap[i] = heap[(i-1)/2]; i = (i-1)/2; }
+        heap[i] = r;
+        return;
+    }
+    if (!ranked_worse(&heap[0], &r)) return;
+    i = 0;
+    while (1) {
+        int c = 2*i + 1;
+        if (c >= *n) break;
+        if (c + 1 < *n && ranked_worse(&heap[c+1], &heap[c])) c++;
+        if (!ranked_worse(&heap[c], &r)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = r;
+}
+
+static int ranked_cmp(const void *a, const void *b) {
+    const Ranked *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return x->idx - y->idx;
+}
+
+typedef struct {
+    const int *cand;    // NULL: every entry
+    const char *pat;
+    int plen;
+    int *out;           // shard s compacts its matches from out[begin]
+    int shard_n[64];
+    int shard_begin[64];
+    Ranked *heaps;      // FUZZY_TOP_K per shard
+    int heap_n[64];
+} FuzzyJob;
+
+static void fuzzy_shard(void *ctx, int begin, int end, int shard) {
+    FuzzyJob *j = ctx;
+    Ranked *heap = j->heaps + (size_t)shard * FUZZY_TOP_K;
+    int n = 0, hn = 0;
+    for (int c = begin; c < end; c++) {
+        int i = j->cand ? j->cand[c] : c;
+        if (ENT_IS(i, ENT_DELETED)) continue;
+        int sc = fuzzy_score(ENT_NAME(i), app.st.name_len[i], j->pat, j->plen);
+        if (sc < 0) continue;
+        j->out[begin + n++] = i;
+        topk_push(heap, &hn, FUZZY_TOP_K, (Ranked){sc, i});
+    }
+    j->shard_begin[shard] = begin;
+    j->shard_n[shard] = n;
+    j->heap_n[shard] = hn;
+}
+
+// Scores the candidates on all cores. Returns the matches in candidate
+// order and lays out app.vis as the top-K best followed by the rest.
+int *fuzzy_rank(const int *cand, int n_cand, int *n_out) {
+    int *out = safe_malloc(sizeof(int) * (n_cand > 0 ? n_cand : 1), "fuzzy matches");
+    int t = shard_count(n_cand);
+    FuzzyJob *j = calloc(1, sizeof(FuzzyJob));
+    Ranked *heaps = safe_malloc(sizeof(Ranked) * FUZZY_TOP_K * t, "fuzzy heaps");
+    if (!out || !j || !heaps) { free(out); free(j); free(heaps); return NULL; }
+    j->cand = cand;
+    j->pat = app.filter_lc;
+    j->plen = strlen(app.filter_lc);
+    j->out = out;
+    j->heaps = heaps;
+    parallel_for(n_cand, fuzzy_shard, j);
+    
+    int n = 0, nr = 0;
+    for (int s = 0; s < t; s++) {
+        memmove(out + n, out + j->shard_begin[s], sizeof(int) * j->shard_n[s]);
+        n += j->shard_n[s];
+        memmove(heaps + nr, heaps + (size_t)s * FUZZY_TOP_K, sizeof(Ranked) * j->heap_n[s]);
+        nr += j->heap_n[s];
+    }
+    qsort(heaps, nr, sizeof(Ranked), ranked_cmp);
+    if (nr > FUZZY_TOP_K) nr = FUZZY_TOP_K;
+    
+    if (app.vis_cap < n) {
+        int *nv = safe_realloc(app.vis, sizeof(int) * n, "visible index");
+        if (!nv) { free(out); free(j); free(heaps); return NULL; }
+        app.vis = nv;
+        app.vis_cap = n;
+    }
+    app.n_visible = 0;
+    for (int r = 0; r < nr; r++) {
+        app.vis[app.n_visible++] = heaps[r].idx;
+        app.st.flags[heaps[r].idx] |= ENT_RANKED;
+    }
+    for (int r = 0; r < n; r++) {
+        int i = out[r];
+        if (ENT_IS(i, ENT_RANKED)) app.st.flags[i] &= ~ENT_RANKED;
+        else app.vis[app.n_visible++] = i;
+    }
+    free(j);
+    free(heaps);
+    *n_out = n;
+    return out;
+}
+
+// Fuzzy counterpart of the filter passes: rank cand into app.vis and make it the current level
+static int fuzzy_apply(const int *cand, int n_cand) {
+    int n;
+    int *m = fuzzy_rank(cand, n_cand, &n);
+    if (!m) return 0;
+    app.match = m;
+    app.n_match = n;
+    return 1;
+}
+
+static void sync_visible_flags(const int *old, int n_old) {
+    for (int p = 0; p < n_old; p++) app.st.flags[old[p]] &= ~ENT_VISIBLE;
+    app.select_count = 0;
+    for (int p = 0; p < app.n_visible; p++) {
+        app.st.flags[app.vis[p]] |= ENT_VISIBLE;
+        if (ENT_IS(app.vis[p], ENT_SELECTED)) app.select_count++;
+    }
+}
+
+void filter_lower() {
+    size_t i = 0;
+    for (; app.filter[i]; i++) app.filter_lc[i] = fold_ascii(app.filter[i]);
+    app.filter_lc[i] = '\0';
+}
+
+void filter_history_drop() {
+    while (app.flt_depth > 0) free(app.flt_hist[--app.flt_depth]);
+}
+
+void filter_history_clear() {
+    filter_history_drop();
+    free(app.match);
+    app.match = NULL;
+    app.n_match = 0;
+}
+
+void filter_finish() {
+    app.page_count = (app.n_visible + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (app.page_count == 0) app.page_count = 1;
+    app.page_start = 0;
+    app.highlight = 0;
+}
+
+// Full rescan; drops the incremental history
+void apply_filter() {
+    filter_history_clear();
+    if (app.vis_cap < app.st.count) {
+        int cap = app.st.count > 1000 ? app.st.count : 1000;
+        int *nv = safe_realloc(app.vis, sizeof(int) * cap, "visible index");
+        if (!nv) { app.n_visible = 0; return; }
+        app.vis = nv;
+        app.vis_cap = cap;
+    }
+    filter_lower();
+    size_t n = strlen(app.filter_lc);
+    int use_filter = app.filter_active && n > 0;
+    if (use_filter && app.fuzzy && fuzzy_apply(app.order_n == app.st.count ? app.order : NULL, app.st.count)) {
+        for (int i = 0; i < app.st.count; i++) app.st.flags[i] &= ~ENT_VISIBLE;
+        sync_visible_flags(NULL, 0);
+        filter_finish();
+        return;
+    }
+    app.select_count = 0;
+    app.n_visible = 0;
+    for (int k = 0; k < app.st.count; k++) {
+        int i = k < app.order_n ? app.order[k] : k;
+        if (ENT_IS(i, ENT_DELETED)) continue;
+        if (use_filter && !name_matches(i, app.filter_lc, n)) {
+            app.st.flags[i] &= ~ENT_VISIBLE;
+            continue;
+        }
+        app.st.flags[i] |= ENT_VISIBLE;
+        app.vis[app.n_visible++] = i;
+        if (ENT_IS(i, ENT_SELECTED)) app.select_count++;
+    }
+    filter_finish();
+}
+
+// The filter grew by one character: only the current matches can still match
+void filter_narrow() {
+    if (app.flt_depth >= MAX_FILTER_LEN) { apply_filter(); return; }
+    if (app.fuzzy) {
+        // Appending to a subsequence pattern can only drop matches too
+        if (!app.match) { apply_filter(); return; }
+        int *prev = app.match, n_prev = app.n_match;
+        filter_lower();
+        if (!fuzzy_apply(prev, n_prev)) { app.match = NULL; free(prev); apply_filter(); return; }
+        app.flt_hist[app.flt_depth] = prev;
+        app.flt_hist_n[app.flt_depth] = n_prev;
+        app.flt_hist_cap[app.flt_depth] = n_prev;
+        app.flt_depth++;
+        sync_visible_flags(prev, n_prev);
+        filter_finish();
+        return;
+    }
+    int *nv = safe_malloc(sizeof(int) * (app.n_visible > 0 ? app.n_visible : 1), "filter level");
+    if (!nv) { apply_filter(); return; }
+    filter_lower();
+    size_t n = strlen(app.filter_lc);
+    int nn = 0;
+    app.select_count = 0;
+    for (int p = 0; p < app.n_visible; p++) {
+        int i = app.vis[p];
+        if (!name_matches(i, app.filter_lc, n)) {
+            app.st.flags[i] &= ~ENT_VISIBLE;
+            continue;
+        }
+        nv[nn++] = i;
+        if (ENT_IS(i, ENT_SELECTED)) app.select_count++;
+    }
+    app.flt_hist[app.flt_depth] = app.vis;
+    app.flt_hist_n[app.flt_depth] = app.n_visible;
+    app.flt_hist_cap[app.flt_depth] = app.vis_cap;
+    app.flt_depth++;
+    app.vis = nv;
+    app.n_visible = nn;
+    app.vis_cap = app.n_visible > 0 ? app.n_visible : 1;
+    filter_finish();
+}
+
+// The filter lost its last character: restore the saved superset
+void filter_widen() {
+    if (app.flt_depth == 0) { apply_filter(); return; }
+    if (app.fuzzy) {
+        filter_lower();
+        if (!app.filter_lc[0]) { apply_filter(); return; }
+        int *cur = app.match, n_cur = app.n_match;
+        app.flt_depth--;
+        int *prev = app.flt_hist[app.flt_depth], n_prev = app.flt_hist_n[app.flt_depth];
+        app.match = NULL;
+        if (!fuzzy_apply(prev, n_prev)) { free(cur); free(prev); apply_filter(); return; }
+        free(prev);
+        sync_visible_flags(cur, n_cur);
+        free(cur);
+        filter_finish();
+        return;
+    }
+    free(app.vis);
+    app.flt_depth--;
+    app.vis = app.flt_hist[app.flt_depth];
+    app.n_visible = app.flt_hist_n[app.flt_depth];
+    app.vis_cap = app.flt_hist_cap[app.flt_depth];
+    filter_lower();
+    app.select_count = 0;
+    for (int p = 0; p < app.n_visible; p++) {
+        int i = app.vis[p];
+        app.st.flags[i] |= ENT_VISIBLE;
+        if (ENT_IS(i, ENT_SELECTED)) app.select_count++;
+    }
+    filter_finish();
+}
+
+// Entries [from, count) were appended: add the ones that pass the filter
+// to the end of the visible list without moving the cursor.
+void filter_extend(int from) {
+    int n_new = app.st.count - from;
+    if (n_new <= 0) return;
+    if (app.vis_cap < app.n_visible + n_new) {
+        int cap = app.vis_cap * 2 > app.n_visible + n_new ? app.vis_cap * 2 : app.n_visible + n_new;
+        int *nv = safe_realloc(app.vis, sizeof(int) * cap, "visible index");
+        if (!nv) return;
+        app.vis = nv;
+        app.vis_cap = cap;
+    }
+    filter_history_drop();
+    size_t n = strlen(app.filter_lc);
+    int use_filter = app.filter_active && n > 0;
+    if (use_filter && app.fuzzy && app.match) {
+        int *nm = safe_realloc(app.match, sizeof(int) * (app.n_match + n_new), "fuzzy matches");
+        if (!nm) return;
+        app.match = nm;
+    }
+    for (int i = from; i < app.st.count; i++) {
+        if (use_filter) {
+            if (app.fuzzy ? fuzzy_score(ENT_NAME(i), app.st.name_len[i], app.filter_lc, n) < 0
+                          : !name_matches(i, app.filter_lc, n)) continue;
+            if (app.fuzzy && app.match) app.match[app.n_match++] = i;
+        }
+        app.st.flags[i] |= ENT_VISIBLE;
+        app.vis[app.n_visible++] = i;
+        if (ENT_IS(i, ENT_SELECTED)) app.select_count++;
+    }
+    app.page_count = (app.n_visible + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (app.page_count == 0) app.page_count = 1;
+}
+
+// Entry index under the cursor, or -1 when nothing is visible
+int cur_index() {
+    if (app.highlight < 0 || app.highlight >= app.n_visible) return -1;
+    return app.vis[app.highlight];
+}
+
+void move_cursor(int pos) {
+    if (app.n_visible == 0) { app.highlight = 0; app.page_start = 0; return; }
+    if (pos < 0) pos = 0;
+    if (pos >= app.n_visible) pos = app.n_visible - 1;
+    app.highlight = pos;
+    app.page_start = (pos / PAGE_SIZE) * PAGE_SIZE;
+}
+
+void* safe_malloc(size_t size, const char *ctx) {
+    void *p = malloc(size);
+    if (!p) {
+        status_error("Bellek yetersiz: %s", ctx);
+        return NULL;
+    }
+    return p;
+}
+
+void* safe_realloc(void *p, size_t size, const char *ctx) {
+    void *np = realloc(p, size);
+    if (!np) {
+        status_error("Bellek yetersiz: %s", ctx);
+        return NULL;
+    }
+    return np;
+}
+
+// DIRECTORY READER
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void store_free(EntryStore *st) {
+    free(st->names);
+    free(st->name_off);
+    free(st->name_len);
+    free(st->flags);
+    free(st->size);
+    free(st->mtime);
+    memset(st, 0, sizeof(*st));
+}
+
+int store_grow(EntryStore *st) {
+    int cap = st->cap ? st->cap * 2 : 1024;
+    uint32_t *off = safe_realloc(st->name_off, sizeof(uint32_t) * cap, "expand entries");
+    if (!off) return 0;
+    st->name_off = off;
+    uint16_t *len = safe_realloc(st->name_len, sizeof(uint16_t) * cap, "expand entries");
+    if (!len) return 0;
+    st->name_len = len;
+    uint8_t *flags = safe_realloc(st->flags, cap, "expand entries");
+    if (!flags) return 0;
+    st->flags = flags;
+    off_t *size = safe_realloc(st->size, sizeof(off_t) * cap, "expand entries");
+    if (!size) return 0;
+    st->size = size;
+    int64_t *mtime = safe_realloc(st->mtime, sizeof(int64_t) * cap, "expand entries");
+    if (!mtime) return 0;
+    st->mtime = mtime;
+    st->cap = cap;
+    return 1;
+}
+
+// Appends a name to the arena and returns the new entry index, or -1
+int store_push(EntryStore *st, const char *name, size_t len, uint8_t flags) {
+    if (len >= MAX_PATH) len = MAX_PATH - 1;
+    if (st->count >= st->cap && !store_grow(st)) return -1;
+    if (st->names_len + len + 1 > UINT32_MAX) return -1;
+    if (st->names_len + len + 1 + ARENA_PAD > st->names_cap) {
+        size_t cap = st->names_cap ? st->names_cap * 2 : 64 * 1024;
+        while (cap < st->names_len + len + 1 + ARENA_PAD) cap *= 2;
+        char *names = safe_realloc(st->names, cap, "name arena");
+        if (!names) return -1;
+        st->names = names;
+        st->names_cap = cap;
+    }
+    int i = st->count++;
+    st->name_off[i] = (uint32_t)st->names_len;
+    st->name_len[i] = (uint16_t)len;
+    memcpy(st->names + st->names_len, name, len);
+    st->names[st->names_len + len] = '\0';
+    st->names_len += len + 1;
+    st->flags[i] = flags;
+    st->size[i] = 0;
+    st->mtime[i] = 0;
+    return i;
+}
+
+// Moves every entry of src to the end of dst
+int store_append(EntryStore *dst, const EntryStore *src) {
+    while (dst->count + src->count > dst->cap) {
+        if (!store_grow(dst)) return 0;
+    }
+    if (dst->names_len + src->names_len > UINT32_MAX) return 0;
+    if (dst->names_len + src->names_len + ARENA_PAD > dst->names_cap) {
+        size_t cap = dst->names_cap ? dst->names_cap * 2 : 64 * 1024;
+        while (cap < dst->names_len + src->names_len + ARENA_PAD) cap *= 2;
+        char *names = safe_realloc(dst->names, cap, "name arena");
+        if (!names) return 0;
+        dst->names = names;
+        dst->names_cap = cap;
+    }
+    memcpy(dst->names + dst->names_len, src->names, src->names_len);
+    for (int i = 0; i < src->count; i++) dst->name_off[dst->count + i] = src->name_off[i] + (uint32_t)dst->names_len;
+    memcpy(dst->name_len + dst->count, src->name_len, sizeof(uint16_t) * src->count);
+    memcpy(dst->flags + dst->count, src->flags, src->count);
+    memcpy(dst->size + dst->count, src->size, sizeof(off_t) * src->count);
+    memcpy(dst->mtime + dst->count, src->mtime, sizeof(int64_t) * src->count);
+    dst->names_len += src->names_len;
+    dst->count += src->count;
+    return 1;
+}
+
+// Fills type, size and mtime relative to the directory fd; follows symlinks like stat().
+void stat_entry_at(EntryStore *st, int dir_fd, int i) {
+    if (st->flags[i] & ENT_STATTED) return;
+    st->flags[i] |= ENT_STATTED;
+    struct statx stx;
+    if (dir_fd >= 0 && statx(dir_fd, st->names + st->name_off[i], AT_STATX_DONT_SYNC, STATX_TYPE|STATX_SIZE|STATX_MTIME, &stx) == 0) {
+        if (S_ISDIR(stx.stx_mode)) st->flags[i] |= ENT_DIR;
+        else st->flags[i] &= ~ENT_DIR;
+        st->size[i] = stx.stx_size;
+        st->mtime[i] = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+    }
+}
+
+void stat_entry(int i) {
+    stat_entry_at(&app.st, app.dir_fd, i);
+}
+
+// SORTING
+// The display order is a permutation of the store (app.order). Natural name
+// order is worked out once per listing (app.name_order); every mode then
+// stable-radix-sorts that order by one 64-bit key per entry, so names break
+// ties for free and a re-sort touches no names and stats nothing new.
+// Bit 63 of the key puts directories first.
+const char *sort_names[] = {"Unsorted", "Name", "Size", "Modified", "Extension"};
+int sort_mode = SORT_NAME, sort_dirs_first = 1;
+
+typedef struct {
+    uint64_t key;
+    int idx;
+} SortItem;
+
+// Case-insensitive, digit runs compared by value; raw bytes break ties
+int natural_cmp(const char *a, int la, const char *b, int lb) {
+    int i = 0, j = 0;
+    while (i < la && j < lb) {
+        if (isdigit((unsigned char)a[i]) && isdigit((unsigned char)b[j])) {
+            while (i < la && a[i] == '0') i++;
+            while (j < lb && b[j] == '0') j++;
+            int si = i, sj = j;
+            while (i < la && isdigit((unsigned char)a[i])) i++;
+            while (j < lb && isdigit((unsigned char)b[j])) j++;
+            if (i - si != j - sj) return i - si < j - sj ? -1 : 1;
+            int c = memcmp(a + si, b + sj, i - si);
+            if (c) return c;
+            continue;
+        }
+        unsigned char ca = fold_ascii(a[i]), cb = fold_ascii(b[j]);
+        if (ca != cb) return ca < cb ? -1 : 1;
+        i++;
+        j++;
+    }
+    if (i < la || j < lb) return i < la ? 1 : -1;
+    int c = memcmp(a, b, la < lb ? la : lb);
+    return c ? c : la - lb;
+}
+
+// First 8 bytes of the name as natural_cmp sees it: folded characters, and
+// each digit run as a length byte ('0' + digits) followed by its digits.
+// Runs of 9+ digits stop the key, leaving the rest to natural_cmp.
+static uint64_t natural_key(const char *s, int n) {
+    uint64_t k = 0;
+    int bytes = 0;
+    for (int i = 0; i < n && bytes < 8;) {
+        if (!isdigit((unsigned char)s[i])) {
+            k = k << 8 | fold_ascii(s[i++]);
+            bytes++;
+            continue;
+        }
+        while (i < n && s[i] == '0') i++;
+        int start = i;
+        while (i < n && isdigit((unsigned char)s[i])) i++;
+        int len = i - start;
+        k = k << 8 | ('0' + (len > 9 ? 9 : len));
+        bytes++;
+        if (len >= 9) break;
+        for (int d = start; d < i && bytes < 8; d++, bytes++) k = k << 8 | (unsigned char)s[d];
+    }
+    return bytes < 8 ? k << (8 * (8 - bytes)) : k;
+}
+
+// Extension without the dot; dotfiles and names without one have none
+static const char *ent_ext(int i, int *len) {
+    const char *name = ENT_NAME(i);
+    const char *dot = memrchr(name, '.', app.st.name_len[i]);
+    if (!dot || dot == name) { *len = 0; return name; }
+    *len = app.st.name_len[i] - (int)(dot + 1 - name);
+    return dot + 1;
+}
+
+// First 7 folded bytes of the extension, below the directory bit
+static uint64_t ext_key(int i) {
+    int n;
+    const char *e = ent_ext(i, &n);
+    uint64_t k = 0;
+    for (int b = 0; b < 7; b++) k = k << 8 | (b < n ? fold_ascii(e[b]) : 0);
+    return k;
+}
+
+typedef struct {
+    SortItem *a;
+    const int *base;    // entry at each position, NULL: the position itself
+} SortKeys;
+
+static void name_key_shard(void *ctx, int begin, int end, int shard) {
+    (void)shard;
+    int from = *(int *)ctx;
+    for (int i = from + begin; i < from + end; i++) app.name_key[i] = natural_key(ENT_NAME(i), app.st.name_len[i]);
+}
+
+static void stat_shard(void *ctx, int begin, int end, int shard) {
+    (void)ctx; (void)shard;
+    for (int i = begin; i < end; i++) stat_entry_at(&app.st, app.dir_fd, i);
+}
+
+static void sort_key_shard(void *ctx, int begin, int end, int shard) {
+    (void)shard;
+    SortKeys *s = ctx;
+    for (int p = begin; p < end; p++) {
+        int i = s->base ? s->base[p] : p;
+        uint64_t k;
+        switch (sort_mode) {
+            case SORT_NAME: k = 0; break;
+            // Largest and newest first
+            case SORT_SIZE: k = (uint64_t)(INT64_MAX - (app.st.size[i] > 0 ? app.st.size[i] : 0)); break;
+            case SORT_MTIME: k = (uint64_t)(INT64_MAX - (app.st.mtime[i] > 0 ? app.st.mtime[i] : 0)); break;
+            case SORT_EXT: k = ext_key(i); break;
+            default: k = p; break;
+        }
+        if (sort_dirs_first && !ENT_IS(i, ENT_DIR)) k |= 1ULL << 63;
+        s->a[p] = (SortItem){k, i};
+    }
+}
+
+static void name_item_shard(void *ctx, int begin, int end, int shard) {
+    (void)shard;
+    SortItem *a = ctx;
+    for (int i = begin; i < end; i++) a[i] = (SortItem){app.name_key[i], i};
+}
+
+typedef struct {
+    SortItem *src, *dst;
+    int shift;
+    uint32_t hist[64][256];     // per shard digit counts, then write positions
+} RadixPass;
+
+static void radix_hist_shard(void *ctx, int begin, int end, int shard) {
+    RadixPass *r = ctx;
+    uint32_t *h = r->hist[shard];
+    memset(h, 0, sizeof(r->hist[0]));
+    for (int i = begin; i < end; i++) h[(r->src[i].key >> r->shift) & 0xff]++;
+}
+
+static void radix_scatter_shard(void *ctx, int begin, int end, int shard) {
+    RadixPass *r = ctx;
+    uint32_t *pos = r->hist[shard];
+    for (int i = begin; i < end; i++) r->dst[pos[(r->src[i].key >> r->shift) & 0xff]++] = r->src[i];
+}
+
+// Stable LSD radix sort over the key bytes that actually vary; returns
+// whichever of a and tmp holds the result, or NULL
+static SortItem *radix_sort(SortItem *a, SortItem *tmp, int n) {
+    uint64_t all_or = 0, all_and = ~0ULL;
+    for (int i = 0; i < n; i++) {
+        all_or |= a[i].key;
+        all_and &= a[i].key;
+    }
+    RadixPass *r = malloc(sizeof(RadixPass));
+    if (!r) return NULL;
+    int t = shard_count(n);
+    for (int shift = 0; shift < 64; shift += 8) {
+        if ((((all_or ^ all_and) >> shift) & 0xff) == 0) continue;
+        r->src = a;
+        r->dst = tmp;
+        r->shift = shift;
+        parallel_for(n, radix_hist_shard, r);
+        uint32_t pos = 0;
+        for (int d = 0; d < 256; d++) {
+            for (int s = 0; s < t; s++) {
+                uint32_t c = r->hist[s][d];
+                r->hist[s][d] = pos;
+                pos += c;
+            }
+        }
+        parallel_for(n, radix_scatter_shard, r);
+        SortItem *x = a; a = tmp; tmp = x;
+    }
+    free(r);
+    return a;
+}
+
+static int name_tie_cmp(const void *pa, const void *pb) {
+    int a = ((const SortItem *)pa)->idx, b = ((const SortItem *)pb)->idx;
+    return natural_cmp(ENT_NAME(a), app.st.name_len[a], ENT_NAME(b), app.st.name_len[b]);
+}
+
+// Extensions longer than the key, then the name order the items came in
+static int ext_tie_cmp(const void *pa, const void *pb) {
+    const SortItem *x = pa, *y = pb;
+    int na, nb;
+    const char *ea = ent_ext(x->idx, &na), *eb = ent_ext(y->idx, &nb);
+    for (int k = 0; k < na && k < nb; k++) {
+        if (fold_ascii(ea[k]) != fold_ascii(eb[k])) return fold_ascii(ea[k]) < fold_ascii(eb[k]) ? -1 : 1;
+    }
+    if (na != nb) return na < nb ? -1 : 1;
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+typedef struct {
+    SortItem *a;
+    int n;
+    int (*cmp)(const void *, const void *);
+} TieJob;
+
+// Finishes the runs of equal keys that start in [begin, end). A run may
+// reach into the next shard, which reads its keys to skip it, so each run
+// is sorted in a private copy and only the idx fields are written back.
+static void tie_shard(void *ctx, int begin, int end, int shard) {
+    (void)shard;
+    TieJob *t = ctx;
+    SortItem *run = NULL;
+    int cap = 0;
+    int i = begin;
+    while (i > 0 && i < t->n && t->a[i - 1].key == t->a[i].key) i++;
+    while (i < end) {
+        int j = i + 1;
+        while (j < t->n && t->a[j].key == t->a[i].key) j++;
+        int longer = t->cmp != ext_tie_cmp;
+        for (int k = i; k < j && !longer; k++) {
+            int len;
+            ent_ext(t->a[k].idx, &len);
+            longer = len > 7;
+        }
+        if (j - i > 1 && longer) {
+            if (j - i > cap) {
+                SortItem *r = realloc(run, sizeof(SortItem) * (j - i));
+                if (!r) break;
+                run = r;
+                cap = j - i;
+            }
+            // Stable: the copy's key holds the name order the run came in
+            for (int k = i; k < j; k++) run[k - i] = (SortItem){k, t->a[k].idx};
+            qsort(run, j - i, sizeof(SortItem), t->cmp);
+            for (int k = i; k < j; k++) t->a[k].idx = run[k - i].idx;
+        }
+        i = j;
+    }
+    free(run);
+}
+
+static SortItem *sort_items(SortItem *a, SortItem *tmp, int n, int (*cmp)(const void *, const void *)) {
+    SortItem *sorted = radix_sort(a, tmp, n);
+    if (sorted && cmp) {
+        TieJob tj = {sorted, n, cmp};
+        parallel_for(n, tie_shard, &tj);
+    }
+    return sorted;
+}
+
+// Natural name order of the whole store; kept until entries are added
+static int build_name_order(int n, SortItem *a, SortItem *tmp) {
+    if (app.name_key_n < n) {
+        uint64_t *nk = safe_realloc(app.name_key, sizeof(uint64_t) * n, "sort keys");
+        if (!nk) return 0;
+        app.name_key = nk;
+        int from = app.name_key_n;
+        parallel_for(n - from, name_key_shard, &from);
+        app.name_key_n = n;
+    }
+    int *no = safe_realloc(app.name_order, sizeof(int) * n, "sort order");
+    if (!no) return 0;
+    app.name_order = no;
+    parallel_for(n, name_item_shard, a);
+    SortItem *sorted = sort_items(a, tmp, n, name_tie_cmp);
+    if (!sorted) return 0;
+    for (int i = 0; i < n; i++) no[i] = sorted[i].idx;
+    app.name_order_n = n;
+    return 1;
+}
+
+// Rebuilds app.order for the current mode. Size and mtime need every entry
+// stat'ed; that happens once, later sorts reuse the stored values.
+void sort_listing() {
+    int n = app.st.count;
+    app.order_n = 0;
+    if (n == 0 || (sort_mode == SORT_NONE && !sort_dirs_first)) return;
+    if (sort_mode == SORT_SIZE || sort_mode == SORT_MTIME) parallel_for(n, stat_shard, NULL);
+    
+    SortItem *a = safe_malloc(sizeof(SortItem) * n, "sort"), *tmp = safe_malloc(sizeof(SortItem) * n, "sort");
+    int *order = app.order_cap >= n ? app.order : safe_realloc(app.order, sizeof(int) * n, "sort order");
+    if (!a || !tmp || !order) { free(a); free(tmp); return; }
+    app.order = order;
+    if (app.order_cap < n) app.order_cap = n;
+    if (sort_mode != SORT_NONE && app.name_order_n < n && !build_name_order(n, a, tmp)) { free(a); free(tmp); return; }
+    
+    SortKeys sk = {a, sort_mode == SORT_NONE ? NULL : app.name_order};
+    parallel_for(n, sort_key_shard, &sk);
+    SortItem *sorted = sort_items(a, tmp, n, sort_mode == SORT_EXT ? ext_tie_cmp : NULL);
+    if (sorted) {
+        for (int i = 0; i < n; i++) app.order[i] = sorted[i].idx;
+        app.order_n = n;
+    }
+    free(a);
+    free(tmp);
+}
+
+// Re-sorts and refilters; keep_cursor leaves the cursor on the same entry
+void resort_listing(int keep_cursor) {
+    int cur = cur_index();
+    sort_listing();
+    apply_filter();
+    if (!keep_cursor || cur < 0) return;
+    for (int p = 0; p < app.n_visible; p++) {
+        if (app.vis[p] == cur) { move_cursor(p); break; }
+    }
+}
+
+// EVENT QUEUE
+// Background workers post results here; the main loop drains them when
+// the eventfd becomes readable, so only the main thread touches app.
+EventQueue events = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, -1};
+
+int events_init() {
+    events.wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    return events.wake_fd >= 0;
+}
+
+void post_event(EventType type, unsigned gen, void *data) {
+    Event *ev = malloc(sizeof(Event));
+    if (!ev) return;
+    *ev = (Event){type, gen, data, NULL};
+    pthread_mutex_lock(&events.lock);
+    if (events.tail) events.tail->next = ev;
+    else events.head = ev;
+    events.tail = ev;
+    pthread_mutex_unlock(&events.lock);
+    uint64_t one = 1;
+    if (write(events.wake_fd, &one, sizeof(one)) < 0) { /* counter saturated: a wakeup is pending anyway */ }
+}
+
+Event *take_events() {
+    uint64_t v;
+    if (read(events.wake_fd, &v, sizeof(v)) < 0) { /* nothing pending */ }
+    pthread_mutex_lock(&events.lock);
+    Event *ev = events.head;
+    events.head = events.tail = NULL;
+    pthread_mutex_unlock(&events.lock);
+    return ev;
+}
+
+// ASYNC LOADER
+// A worker reads the directory and publishes entries in batches. The first
+// read uses a small buffer so the first page can be drawn right away.
+typedef struct LoadJob {
+    int dir_fd;
+    int inotify_fd;     // private dup; the watch is added here before scanning
+    char *path;
+    unsigned gen;
+    atomic_int cancel;
+    atomic_int refs;
+} LoadJob;
+
+typedef struct {
+    EntryStore st;
+    int done;
+    int err;
+    int watch_wd;
+    double elapsed_ms;
+} LoadBatch;
+
+void load_job_release(LoadJob *job) {
+    if (atomic_fetch_sub(&job->refs, 1) == 1) {
+        close(job->dir_fd);
+        if (job->inotify_fd >= 0) close(job->inotify_fd);
+        free(job->path);
+        free(job);
+    }
+}
+
+static void publish_batch(LoadJob *job, LoadBatch *b) {
+    if (atomic_load(&job->cancel)) {
+        store_free(&b->st);
+        free(b);
+        return;
+    }
+    post_event(EV_LOAD_BATCH, job->gen, b);
+}
+
+static void *load_worker(void *p) {
+    LoadJob *job = p;
+    double t0 = now_ms();
+    size_t bufsz = DENTS_FIRST_BUF;
+    char *buf = malloc(DENTS_BUF_SIZE);
+    LoadBatch *b = calloc(1, sizeof(LoadBatch));
+    int err = 0;
+    if (!buf || !b) err = ENOMEM;
+    // Adding a watch walks every cached child dentry, so it is done here, not on the UI thread
+    int wd = job->inotify_fd >= 0 ? inotify_add_watch(job->inotify_fd, job->path, WATCH_MASK) : -1;
+    
+    while (!err && !atomic_load(&job->cancel)) {
+        long nread = syscall(SYS_getdents64, job->dir_fd, buf, bufsz);
+        if (nread <= 0) {
+            if (nread < 0) err = errno;
+            break;
+        }
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0) continue;
+            int i = store_push(&b->st, de->d_name, strlen(de->d_name), de->d_type == DT_DIR ? ENT_DIR : 0);
+            if (i < 0) { err = ENOMEM; break; }
+            // d_type is authoritative except for symlinks and filesystems that don't fill it
+            if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) stat_entry_at(&b->st, job->dir_fd, i);
+        }
+        publish_batch(job, b);
+        b = calloc(1, sizeof(LoadBatch));
+        if (!b) err = ENOMEM;
+        bufsz = DENTS_BUF_SIZE;
+    }
+    
+    if (!b) b = calloc(1, sizeof(LoadBatch));
+    if (b) {
+        b->done = 1;
+        b->err = err;
+        b->watch_wd = wd;
+        b->elapsed_ms = now_ms() - t0;
+        publish_batch(job, b);
+    }
+    free(buf);
+    load_job_release(job);
+    return NULL;
+}
+
+void load_cancel() {
+    if (!app.load_job) return;
+    atomic_store(&app.load_job->cancel, 1);
+    load_job_release(app.load_job);
+    app.load_job = NULL;
+    app.loading = 0;
+}
+
+int watch_flush_backlog();
+int watch_ready(Event *ev);
+int du_merge(Event *ev);
+int search_merge(Event *ev);
+int index_merge(Event *ev);
+int delete_merge(Event *ev);
+int name_lookup(const char *name);
+
+// Puts the cursor on app.jump, if the listing has it, once it is complete
+static void jump_resolve() {
+    if (!app.jump[0]) return;
+    int i = name_lookup(app.jump);
+    app.jump[0] = '\0';
+    for (int p = 0; i >= 0 && p < app.n_visible; p++) {
+        if (app.vis[p] == i) { move_cursor(p); break; }
+    }
+}
+
+// Merges a worker batch into the listing; returns 1 if the UI changed
+int load_merge(Event *ev) {
+    LoadBatch *b = ev->data;
+    int changed = 0;
+    if (ev->gen == app.load_gen && app.loading) {
+        int from = app.st.count;
+        if (store_append(&app.st, &b->st)) filter_extend(from);
+        if (b->done) {
+            app.loading = 0;
+            app.load_ms = b->elapsed_ms;
+            app.load_rate = app.load_ms > 0 ? app.st.count * 1000.0 / app.load_ms : 0;
+            if (b->err) status_error("Dizin okunamadi: %s", strerror(b->err));
+            if (app.load_job) { load_job_release(app.load_job); app.load_job = NULL; }
+            app.watch_wd = b->watch_wd;
+            app.watch_pending = 0;
+            resort_listing(app.highlight > 0);
+            jump_resolve();
+            du_start();
+            watch_flush_backlog();
+        }
+        changed = 1;
+    }
+    store_free(&b->st);
+    free(b);
+    return changed;
+}
+
+// Drains posted events; returns 1 if anything visible changed
+int process_events() {
+    Event *ev = take_events();
+    int changed = 0;
+    while (ev) {
+        Event *next = ev->next;
+        switch (ev->type) {
+            case EV_LOAD_BATCH: changed |= load_merge(ev); break;
+            case EV_WATCH_READY: changed |= watch_ready(ev); break;
+            case EV_DU_SIZE: case EV_DU_DONE: changed |= du_merge(ev); break;
+            case EV_SEARCH_BATCH: changed |= search_merge(ev); break;
+            case EV_INDEX_DONE: changed |= index_merge(ev); break;
+            case EV_DELETE_PROGRESS: case EV_DELETE_DONE: changed |= delete_merge(ev); break;
+        }
+        free(ev);
+        ev = next;
+    }
+    return changed;
+}
+
+// INOTIFY REFRESH
+// The current directory is watched and its events are applied to the
+// listing in place, so selection, filter and cursor survive external and
+// internal changes alike. IN_Q_OVERFLOW falls back to a full reload.
+static uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+void name_index_free() {
+    free(app.name_index);
+    app.name_index = NULL;
+    app.name_index_cap = app.name_index_used = 0;
+}
+
+static void name_index_put(int i) {
+    uint32_t mask = app.name_index_cap - 1;
+    uint32_t h = name_hash(ENT_NAME(i)) & mask;
+    while (app.name_index[h] >= 0) h = (h + 1) & mask;
+    app.name_index[h] = i;
+    app.name_index_used++;
+}
+
+// Sizes the table for the whole store (tombstones are dropped on rebuild)
+int name_index_build() {
+    int cap = 1024;
+    while (cap < app.st.count * 2 + 2) cap *= 2;
+    int *t = safe_malloc(sizeof(int) * cap, "name index");
+    if (!t) return 0;
+    free(app.name_index);
+    app.name_index = t;
+    app.name_index_cap = cap;
+    app.name_index_used = 0;
+    for (int k = 0; k < cap; k++) t[k] = -1;
+    for (int i = 0; i < app.st.count; i++) {
+        if (!ENT_IS(i, ENT_DELETED)) name_index_put(i);
+    }
+    return 1;
+}
+
+// Slot holding name, or -1
+static int name_index_slot(const char *name) {
+    if (!app.name_index && !name_index_build()) return -1;
+    uint32_t mask = app.name_index_cap - 1;
+    uint32_t h = name_hash(name) & mask;
+    while (app.name_index[h] != -1) {
+        int i = app.name_index[h];
+        if (i >= 0 && strcmp(ENT_NAME(i), name) == 0) return h;
+        h = (h + 1) & mask;
+    }
+    return -1;
+}
+
+int name_lookup(const char *name) {
+    int slot = name_index_slot(name);
+    return slot < 0 ? -1 : app.name_index[slot];
+}
+
+// Dropping a watch waits for an SRCU grace period (tens of ms) and blocks
+// new watches on the same instance meanwhile, so each directory gets a
+// fresh inotify instance and the old one is closed off the main thread.
+static void *unwatch_worker(void *p) {
+    close((int)(intptr_t)p);
+    return NULL;
+}
+
+// Closes the instance; the listing stops following the directory
+void watch_stop() {
+    int old = app.inotify_fd;
+    app.inotify_fd = -1;
+    app.watch_wd = -1;
+    app.watch_pending = 0;
+    if (old >= 0) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, unwatch_worker, (void *)(intptr_t)old) == 0) pthread_detach(tid);
+        else close(old);
+    }
+    free(app.watch_backlog);
+    app.watch_backlog = NULL;
+    app.watch_backlog_len = 0;
+}
+
+// Starts a fresh instance for the current directory. The watch itself is
+// added by the loader (or watch_worker for cached listings); events that
+// arrive before it is confirmed are held in the backlog.
+void watch_directory() {
+    watch_stop();
+    app.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    app.watch_pending = app.inotify_fd >= 0;
+}
+
+typedef struct {
+    int inotify_fd;
+    char *path;
+    unsigned gen;
+    int wd;
+    struct timespec mtime;  // taken after the watch exists
+} WatchJob;
+
+static void *watch_worker(void *p) {
+    WatchJob *w = p;
+    w->wd = inotify_add_watch(w->inotify_fd, w->path, WATCH_MASK);
+    struct stat st;
+    if (stat(w->path, &st) == 0) w->mtime = st.st_mtim;
+    close(w->inotify_fd);
+    post_event(EV_WATCH_READY, w->gen, w);
+    return NULL;
+}
+
+static int watch_insert(const char *name) {
+    int i = name_lookup(name);
+    if (i >= 0) {
+        app.st.flags[i] &= ~ENT_STATTED;
+        stat_entry(i);
+        return 0;
+    }
+    i = store_push(&app.st, name, strlen(name), 0);
+    if (i < 0) return 0;
+    stat_entry(i);
+    if (app.name_index_used * 2 + 2 > app.name_index_cap) name_index_build();
+    else name_index_put(i);
+    return 1;
+}
+
+static int watch_remove(const char *name) {
+    int slot = name_index_slot(name);
+    if (slot < 0) return 0;
+    int i = app.name_index[slot];
+    app.name_index[slot] = -2;
+    if (ENT_IS(i, ENT_SELECTED)) app.select_count--;
+    app.st.flags[i] = (app.st.flags[i] & ENT_DIR) | ENT_DELETED;
+    return 1;
+}
+
+// Drops deleted entries from the visible list in one pass, keeping the cursor on its entry
+static void watch_compact() {
+    int out = 0, hl = app.highlight;
+    for (int p = 0; p < app.n_visible; p++) {
+        if (ENT_IS(app.vis[p], ENT_DELETED)) {
+            if (p < app.highlight) hl--;
+            continue;
+        }
+        app.vis[out++] = app.vis[p];
+    }
+    app.n_visible = out;
+    if (app.match) {
+        int m = 0;
+        for (int p = 0; p < app.n_match; p++) {
+            if (!ENT_IS(app.match[p], ENT_DELETED)) app.match[m++] = app.match[p];
+        }
+        app.n_match = m;
+    }
+    filter_history_drop();
+    app.page_count = (app.n_visible + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (app.page_count == 0) app.page_count = 1;
+    if (hl >= app.n_visible) hl = app.n_visible - 1;
+    move_cursor(hl);
+}
+
+// Applies a buffer of raw inotify events; returns 1 if the listing changed
+// and -1 on queue overflow. Inserts and removes are idempotent, so
+// replaying events that overlap a finished scan is safe.
+static int watch_apply(const char *buf, size_t len) {
+    int from = app.st.count, removed = 0, changed = 0, restat = 0;
+    for (const char *p = buf; p < buf + len;) {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) return -1;
+        if (ev->wd != app.watch_wd) continue;
+        if (ev->mask & (IN_DELETE_SELF|IN_MOVE_SELF)) {
+            status_error("Dizin silindi veya tasindi");
+            changed = 1;
+            continue;
+        }
+        if (!ev->len) continue;
+        if (ev->mask & (IN_CREATE|IN_MOVED_TO)) changed |= watch_insert(ev->name);
+        else if (ev->mask & (IN_DELETE|IN_MOVED_FROM)) removed |= watch_remove(ev->name);
+        else {
+            int i = name_lookup(ev->name);
+            if (i >= 0) { app.st.flags[i] &= ~ENT_STATTED; changed = restat = 1; }
+        }
+    }
+    if (removed) watch_compact();
+    if (app.order_n && (app.st.count > from || (restat && (sort_mode == SORT_SIZE || sort_mode == SORT_MTIME)))) resort_listing(1);
+    else if (app.st.count > from) filter_extend(from);
+    if (du_enabled && !app.du_job && app.st.count > from) du_start();
+    return changed | removed;
+}
+
+// Replays events held back while the directory was loading
+int watch_flush_backlog() {
+    if (!app.watch_backlog) return 0;
+    char *buf = app.watch_backlog;
+    size_t len = app.watch_backlog_len;
+    app.watch_backlog = NULL;
+    app.watch_backlog_len = 0;
+    int changed = watch_apply(buf, len);
+    free(buf);
+    if (changed < 0) { load_directory(); return 1; }
+    return changed;
+}
+
+// Reads every queued event; -1 when the queue overflowed and a reload is due
+static int watch_drain() {
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len;
+    while ((len = read(app.inotify_fd, buf, sizeof(buf))) > 0) {
+        if (!app.loading && !app.watch_pending) {
+            int r = watch_apply(buf, len);
+            if (r < 0) return -1;
+            changed |= r;
+            continue;
+        }
+        char *nb = realloc(app.watch_backlog, app.watch_backlog_len + len);
+        if (!nb) continue;
+        memcpy(nb + app.watch_backlog_len, buf, len);
+        app.watch_backlog = nb;
+        app.watch_backlog_len += len;
+    }
+    return changed;
+}
+
+// A cached listing's watch is in place: replay the backlog, or rescan if
+// the directory changed between the cache check and the watch
+int watch_ready(Event *ev) {
+    WatchJob *w = ev->data;
+    int changed = 0;
+    if (ev->gen == app.load_gen && app.watch_pending) {
+        app.watch_wd = w->wd;
+        app.watch_pending = 0;
+        if (w->wd < 0 || w->mtime.tv_sec != app.dir_mtime.tv_sec || w->mtime.tv_nsec != app.dir_mtime.tv_nsec) {
+            load_directory();
+            changed = 1;
+        } else {
+            changed = watch_flush_backlog();
+        }
+    }
+    free(w->path);
+    free(w);
+    return changed;
+}
+
+int process_inotify() {
+    int changed = watch_drain();
+    if (changed < 0) { load_directory(); return 1; }
+    return changed;
+}
+
+static int grep_begin(const char *pattern);
+
+// Re-reads the listing after our own changes unless the watch will report
+// them; search results are not watched, so the search runs again
+void refresh_listing() {
+    if (app.search[0] && app.search_content) grep_begin(app.search);
+    else if (app.search[0]) search_start(app.search);
+    else if (app.watch_wd < 0 && !app.watch_pending) load_directory();
+}
+
+// LISTING CACHE
+// Recently left directories keep their store, keyed by path and validated
+// by device, inode and mtime. Most recently used first.
+typedef struct CacheEntry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    EntryStore st;
+    int cursor_entry;
+    int cursor_pos;
+    size_t bytes;
+    struct CacheEntry *prev, *next;
+} CacheEntry;
+
+DirCache dir_cache;
+
+size_t store_bytes(const EntryStore *st) {
+    return st->names_cap + (size_t)st->cap * (sizeof(uint32_t) + sizeof(uint16_t) + 1 + sizeof(off_t) + sizeof(int64_t));
+}
+
+static void cache_unlink(CacheEntry *c) {
+    if (c->prev) c->prev->next = c->next;
+    else dir_cache.head = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else dir_cache.tail = c->prev;
+    c->prev = c->next = NULL;
+    dir_cache.count--;
+    dir_cache.bytes -= c->bytes;
+}
+
+static void cache_drop(CacheEntry *c) {
+    cache_unlink(c);
+    store_free(&c->st);
+    free(c->path);
+    free(c);
+}
+
+void cache_clear() {
+    while (dir_cache.head) cache_drop(dir_cache.head);
+}
+
+static CacheEntry *cache_find(const char *path) {
+    for (CacheEntry *c = dir_cache.head; c; c = c->next) {
+        if (strcmp(c->path, path) == 0) return c;
+    }
+    return NULL;
+}
+
+// Hands the current store to the cache when it is complete and still valid
+static void cache_store_current() {
+    if (!app.loaded_dir[0] || app.loading || app.watch_pending || app.dir_fd < 0) return;
+    if (app.watch_wd >= 0) {
+        // The watch kept the store in sync: take the mtime first, then apply
+        // whatever is queued, so anything later makes the entry stale.
+        struct stat st;
+        if (fstat(app.dir_fd, &st) < 0 || watch_drain() < 0) return;
+        app.dir_mtime = st.st_mtim;
+    }
+    CacheEntry *old = cache_find(app.loaded_dir);
+    if (old) cache_drop(old);
+    CacheEntry *c = calloc(1, sizeof(CacheEntry));
+    if (!c || !(c->path = strdup(app.loaded_dir))) { free(c); return; }
+    c->dev = app.dir_dev;
+    c->ino = app.dir_ino;
+    c->mtime = app.dir_mtime;
+    c->st = app.st;
+    memset(&app.st, 0, sizeof(app.st));
+    c->cursor_entry = cur_index();
+    c->cursor_pos = app.highlight;
+    c->bytes = store_bytes(&c->st);
+    c->next = dir_cache.head;
+    if (dir_cache.head) dir_cache.head->prev = c;
+    else dir_cache.tail = c;
+    dir_cache.head = c;
+    dir_cache.count++;
+    dir_cache.bytes += c->bytes;
+    while (dir_cache.tail && dir_cache.tail != c &&
+           (dir_cache.count > CACHE_MAX_DIRS || dir_cache.bytes > CACHE_MEM_CAP)) {
+        cache_drop(dir_cache.tail);
+    }
+    if (c->bytes > CACHE_MEM_CAP) cache_drop(c);
+}
+
+// Moves a still-valid cached listing for the directory open on fd into app
+static int cache_restore(const struct stat *dst) {
+    CacheEntry *c = cache_find(app.current_dir);
+    if (!c) { dir_cache.misses++; return 0; }
+    if (c->dev != dst->st_dev || c->ino != dst->st_ino ||
+        c->mtime.tv_sec != dst->st_mtim.tv_sec || c->mtime.tv_nsec != dst->st_mtim.tv_nsec) {
+        cache_drop(c);
+        dir_cache.misses++;
+        return 0;
+    }
+    cache_unlink(c);
+    app.st = c->st;
+    // Names are current but sizes may not be: restat lazily as rows are drawn
+    for (int i = 0; i < app.st.count; i++) app.st.flags[i] &= ~(ENT_STATTED|ENT_VISIBLE);
+    sort_listing();
+    apply_filter();
+    int pos = c->cursor_pos;
+    if (c->cursor_entry >= 0 && pos < app.n_visible && app.vis[pos] != c->cursor_entry) {
+        for (int p = 0; p < app.n_visible; p++) {
+            if (app.vis[p] == c->cursor_entry) { pos = p; break; }
+        }
+    }
+    move_cursor(pos);
+    free(c->path);
+    free(c);
+    dir_cache.hits++;
+    return 1;
+}
+
+int load_directory() {
+    int reload = strcmp(app.loaded_dir, app.current_dir) == 0;
+    if (!reload) cache_store_current();
+    app.load_gen++;
+    load_cancel();
+    search_cancel();
+    app.search[0] = '\0';
+    name_index_free();
+    store_free(&app.st);
+    app.order_n = app.name_key_n = app.name_order_n = 0;
+    du_cancel();
+    app.du_n = 0;
+    if (app.dir_fd >= 0) {
+        close(app.dir_fd);
+        app.dir_fd = -1;
+    }
+    app.load_rate = 0;
+    app.loaded_dir[0] = '\0';
+    apply_filter();
+    
+    int fd = open(app.current_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+        status_error("Dizin acilamadi: %s", strerror(errno));
+        return 0;
+    }
+    app.dir_fd = fd;
+    struct stat dst;
+    if (fstat(fd, &dst) < 0) memset(&dst, 0, sizeof(dst));
+    app.dir_dev = dst.st_dev;
+    app.dir_ino = dst.st_ino;
+    app.dir_mtime = dst.st_mtim;
+    snprintf(app.loaded_dir, sizeof(app.loaded_dir), "%s", app.current_dir);
+    // Watch before scanning so nothing falls between the scan and the watch
+    watch_directory();
+    
+    if (!reload && cache_restore(&dst)) {
+        WatchJob *w = calloc(1, sizeof(WatchJob));
+        pthread_t tid;
+        if (w && app.inotify_fd >= 0 && (w->path = strdup(app.current_dir)) &&
+            (w->inotify_fd = dup(app.inotify_fd)) >= 0) {
+            w->gen = app.load_gen;
+            if (pthread_create(&tid, NULL, watch_worker, w) == 0) pthread_detach(tid);
+            else { close(w->inotify_fd); free(w->path); free(w); app.watch_pending = 0; }
+        } else {
+            if (w) free(w->path);
+            free(w);
+            app.watch_pending = 0;
+        }
+        jump_resolve();
+        du_start();
+        status_clear();
+        return 1;
+    }
+    
+    // The worker gets its own open file description so its getdents offset is private
+    LoadJob *job = calloc(1, sizeof(LoadJob));
+    if (!job) { status_error("Bellek yetersiz: load job"); app.watch_pending = 0; return 0; }
+    job->dir_fd = openat(fd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (job->dir_fd < 0) {
+        status_error("Dizin acilamadi: %s", strerror(errno));
+        free(job);
+        app.watch_pending = 0;
+        return 0;
+    }
+    job->gen = app.load_gen;
+    job->inotify_fd = app.inotify_fd >= 0 ? dup(app.inotify_fd) : -1;
+    job->path = strdup(app.current_dir);
+    if (!job->path && job->inotify_fd >= 0) { close(job->inotify_fd); job->inotify_fd = -1; }
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->refs, 2);
+    
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, load_worker, job) != 0) {
+        close(job->dir_fd);
+        if (job->inotify_fd >= 0) close(job->inotify_fd);
+        free(job->path);
+        free(job);
+        app.watch_pending = 0;
+        status_error("Yukleyici baslatilamadi");
+        return 0;
+    }
+    pthread_detach(tid);
+    app.load_job = job;
+    app.loading = 1;
+    status_clear();
+    return 1;
+}
+
+// COPY ENGINE
+// Fastest primitive first: reflink, then in-kernel copy_file_range, then
+// sendfile, then plain read/write. Holes are skipped with SEEK_DATA/SEEK_HOLE
+// so sparse files stay sparse. Every primitive is looped: a single call may
+// move far less than asked, and calls are capped at COPY_CHUNK so progress
+// moves while one big file is copied.
+static __thread atomic_llong *copy_meter;  // bytes counter of the calling worker, if any
+
+static inline void copy_metered(off_t n) {
+    if (copy_meter) atomic_fetch_add(copy_meter, n);
+}
+
+static int copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF || err == ETXTBSY;
+}
+
+static int copy_rw(int in, int out, off_t off, off_t len) {
+    char *buf = malloc(RW_BUF_SIZE);
+    if (!buf) return -1;
+    while (len > 0) {
+        ssize_t n = pread(in, buf, len < RW_BUF_SIZE ? (size_t)len : RW_BUF_SIZE, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { free(buf); return n < 0 ? -1 : 0; }
+        for (ssize_t w = 0; w < n;) {
+            ssize_t m = pwrite(out, buf + w, n - w, off + w);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) { free(buf); return -1; }
+            w += m;
+        }
+        copy_metered(n);
+        off += n;
+        len -= n;
+    }
+    free(buf);
+    return 0;
+}
+
+// Copies [off, off+len) to the same offset in out. Stops quietly at EOF if
+// the source shrank. out's file position is only touched by the sendfile
+// fallback, so give each concurrent writer its own descriptor.
+int copy_range(int in, int out, off_t off, off_t len) {
+    off_t in_off = off, out_off = off;
+    while (len > 0) {
+        ssize_t n = copy_file_range(in, &in_off, out, &out_off, len < (off_t)COPY_CHUNK ? (size_t)len : COPY_CHUNK, 0);
+        if (n > 0) { len -= n; copy_metered(n); continue; }
+        if (n == 0) return 0;
+        if (errno == EINTR) continue;
+        if (!copy_unsupported(errno)) return -1;
+        break;
+    }
+    if (len > 0 && lseek(out, out_off, SEEK_SET) == out_off) {
+        while (len > 0) {
+            ssize_t n = sendfile(out, in, &in_off, len < (off_t)COPY_CHUNK ? (size_t)len : COPY_CHUNK);
+            if (n > 0) { len -= n; copy_metered(n); continue; }
+            if (n == 0) return 0;
+            if (errno == EINTR) continue;
+            if (!copy_unsupported(errno)) return -1;
+            break;
+        }
+    }
+    if (len > 0) return copy_rw(in, out, in_off, len);
+    return 0;
+}
+
+// Copies the data of an open regular file; st describes in
+int copy_fd(int in, int out, const struct stat *st) {
+    if (!S_ISREG(st->st_mode)) {
+        // Pipes and devices: stream until EOF
+        char *buf = malloc(RW_BUF_SIZE);
+        if (!buf) return -1;
+        ssize_t n;
+        while ((n = read(in, buf, RW_BUF_SIZE)) != 0) {
+            if (n < 0) { if (errno == EINTR) continue; free(buf); return -1; }
+            for (ssize_t w = 0; w < n;) {
+                ssize_t m = write(out, buf + w, n - w);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) { free(buf); return -1; }
+                w += m;
+            }
+            copy_metered(n);
+        }
+        free(buf);
+        return 0;
+    }
+    if (st->st_size == 0) return 0;
+    if (ioctl(out, FICLONE, in) == 0) {
+        copy_metered(st->st_size);
+        return 0;
+    }
+    
+    // Fewer allocated blocks than the size means holes worth preserving
+    if ((off_t)st->st_blocks * 512 < st->st_size) {
+        off_t data = lseek(in, 0, SEEK_DATA);
+        if (data >= 0 || errno == ENXIO) {
+            off_t done = 0;
+            while (data >= 0 && data < st->st_size) {
+                off_t hole = lseek(in, data, SEEK_HOLE);
+                if (hole < 0) hole = st->st_size;
+                copy_metered(data - done);  // skipped holes count as progress
+                if (copy_range(in, out, data, hole - data) < 0) return -1;
+                done = hole;
+                data = lseek(in, hole, SEEK_DATA);
+            }
+            copy_metered(st->st_size - done);
+            return ftruncate(out, st->st_size);
+        }
+    }
+    return copy_range(in, out, 0, st->st_size);
+}
+
+int copy_file(const char *src, const char *dst) {
+    int fd_src = open(src, O_RDONLY|O_CLOEXEC);
+    if (fd_src < 0) return -1;
+    struct stat st;
+    if (fstat(fd_src, &st) < 0) { close(fd_src); return -1; }
+    int fd_dst = open(dst, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, st.st_mode & 07777);
+    if (fd_dst < 0) { close(fd_src); return -1; }
+    
+    int res = copy_fd(fd_src, fd_dst, &st);
+    int err = errno;
+    close(fd_src);
+    if (close(fd_dst) < 0 && res == 0) return -1;
+    errno = err;
+    return res;
+}
+
+// CONTENT HASH
+// XXH64, written out here rather than vendored: a non-cryptographic hash
+// that keeps up with any disk. verify_hash() runs it over a file range with
+// large sequential preads.
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in) { return xxh_rotl(acc + in * XXH_P2, 31) * XXH_P1; }
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) { return (acc ^ xxh_round(0, v)) * XXH_P1 + XXH_P4; }
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ ? __builtin_bswap64(v) : v;
+}
+
+static inline uint32_t xxh_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ ? __builtin_bswap32(v) : v;
+}
+
+void xxh64_init(Xxh64 *h) {
+    *h = (Xxh64){{XXH_P1 + XXH_P2, XXH_P2, 0, -XXH_P1}};
+}
+
+void xxh64_update(Xxh64 *h, const void *data, size_t len) {
+    const uint8_t *p = data, *end = p + len;
+    h->total += len;
+    if (h->n + len < 32) {
+        memcpy(h->tail + h->n, p, len);
+        h->n += len;
+        return;
+    }
+    if (h->n) {
+        size_t k = 32 - h->n;
+        memcpy(h->tail + h->n, p, k);
+        p += k;
+        for (int i = 0; i < 4; i++) h->v[i] = xxh_round(h->v[i], xxh_read64(h->tail + 8 * i));
+        h->n = 0;
+    }
+    uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
+    for (; end - p >= 32; p += 32) {
+        v0 = xxh_round(v0, xxh_read64(p));
+        v1 = xxh_round(v1, xxh_read64(p + 8));
+        v2 = xxh_round(v2, xxh_read64(p + 16));
+        v3 = xxh_round(v3, xxh_read64(p + 24));
+    }
+    h->v[0] = v0; h->v[1] = v1; h->v[2] = v2; h->v[3] = v3;
+    h->n = end - p;
+    memcpy(h->tail, p, h->n);
+}
+
+uint64_t xxh64_final(const Xxh64 *h) {
+    uint64_t acc;
+    if (h->total >= 32) {
+        acc = xxh_rotl(h->v[0], 1) + xxh_rotl(h->v[1], 7) + xxh_rotl(h->v[2], 12) + xxh_rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++) acc = xxh_merge(acc, h->v[i]);
+    } else {
+        acc = h->v[2] + XXH_P5;
+    }
+    acc += h->total;
+    const uint8_t *p = h->tail;
+    int n = h->n;
+    for (; n >= 8; p += 8, n -= 8) acc = xxh_rotl(acc ^ xxh_round(0, xxh_read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (n >= 4) {
+        acc = xxh_rotl(acc ^ (xxh_read32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) acc = xxh_rotl(acc ^ (*p * XXH_P5), 11) * XXH_P1;
+    acc ^= acc >> 33;
+    acc *= XXH_P2;
+    acc ^= acc >> 29;
+    acc *= XXH_P3;
+    return acc ^ (acc >> 32);
+}
+
+// Hashes [off, off+len) of fd with buf (RW_BUF_SIZE bytes, VERIFY_ALIGN
+// aligned, so O_DIRECT descriptors work when off is aligned too). A file
+// shorter than the range hashes what is there. Returns -1 with errno set.
+int verify_hash(int fd, off_t off, off_t len, char *buf, uint64_t *hash) {
+    Xxh64 h;
+    xxh64_init(&h);
+    while (len > 0) {
+        // Direct reads want whole blocks; the tail past len is read but not hashed
+        size_t want = len < RW_BUF_SIZE ? ((size_t)len + VERIFY_ALIGN - 1) & ~(size_t)(VERIFY_ALIGN - 1) : RW_BUF_SIZE;
+        ssize_t n = pread(fd, buf, want, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        if (n > len) n = len;
+        xxh64_update(&h, buf, n);
+        off += n;
+        len -= n;
+    }
+    *hash = xxh64_final(&h);
+    return 0;
+}
+
+// IO_URING
+// Minimal raw-syscall ring: no liburing dependency. uring_create() returns
+// NULL (and stops further attempts) when the kernel lacks io_uring, it is
+// disabled, or an opcode we need is missing; callers then stay synchronous.
+#define URING_BATCH 256
+#define URING_BUF (16 * 1024)
+
+typedef struct {
+    int fd, dead;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqe_len;
+    unsigned queued;
+    int res[URING_BATCH][4];    // completion results, indexed by user_data
+    char *bufs;
+    struct statx *stx;
+} Uring;
+
+static atomic_int uring_state;  // 0: untried, 1: working, -1: unavailable
+
+static int uring_enter(int fd, unsigned submit, unsigned wait) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned op, void *arg, unsigned n) {
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+void uring_free(Uring *r) {
+    if (!r) return;
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqe_len);
+    if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_len);
+    if (r->sq_map && r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_len);
+    if (r->fd >= 0) close(r->fd);
+    free(r->bufs);
+    free(r->stx);
+    free(r);
+}
+
+// Zeroed SQE tagged with (slot, step) for the result table
+static struct io_uring_sqe *uring_sqe(Uring *r, int slot, int step, int op) {
+    unsigned idx = (*r->sq_tail + r->queued++) & *r->sq_mask;
+    struct io_uring_sqe *s = &r->sqes[idx];
+    memset(s, 0, sizeof(*s));
+    r->sq_array[idx] = idx;
+    s->opcode = op;
+    s->user_data = (uint64_t)slot << 2 | step;
+    return s;
+}
+
+// Submits everything queued and waits for all of it; -1 leaves the ring unusable
+static int uring_run(Uring *r) {
+    unsigned n = r->queued, submitted = 0, reaped = 0;
+    __atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+    r->queued = 0;
+    while (reaped < n) {
+        int ret = uring_enter(r->fd, n - submitted, n - reaped);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            r->dead = 1;
+            return -1;
+        }
+        if (ret > 0) submitted += ret;
+        unsigned head = *r->cq_head, tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, reaped++) {
+            struct io_uring_cqe *c = &r->cqes[head & *r->cq_mask];
+            r->res[c->user_data >> 2][c->user_data & 3] = c->res;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+Uring *uring_create() {
+    if (atomic_load(&uring_state) < 0) return NULL;
+    Uring *r = calloc(1, sizeof(Uring));
+    if (!r) return NULL;
+    struct io_uring_params p = {0};
+    r->fd = syscall(__NR_io_uring_setup, URING_BATCH * 4, &p);
+    if (r->fd < 0) goto unavailable;
+    
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+        r->cq_len = r->sq_len;
+    }
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map
+              : mmap(NULL, r->cq_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqe_len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) goto fail;
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    
+    static const int needed[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE};
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (!probe) goto fail;
+    int probed = uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256);
+    for (size_t k = 0; probed == 0 && k < sizeof(needed) / sizeof(needed[0]); k++)
+        if (needed[k] > probe->last_op || !(probe->ops[needed[k]].flags & IO_URING_OP_SUPPORTED)) probed = -1;
+    free(probe);
+    if (probed < 0) goto unavailable;
+    
+    // Sparse fixed-file table: sources and targets are opened straight into slots
+    int slots[URING_BATCH];
+    for (int i = 0; i < URING_BATCH; i++) slots[i] = -1;
+    if (uring_register(r->fd, IORING_REGISTER_FILES, slots, URING_BATCH) < 0) goto unavailable;
+    
+    // Direct opens (file_index) are newer than the opcodes; try one
+    struct io_uring_sqe *s = uring_sqe(r, 0, 0, IORING_OP_OPENAT);
+    s->fd = AT_FDCWD;
+    s->addr = (uint64_t)(uintptr_t)"/";
+    s->open_flags = O_RDONLY|O_DIRECTORY;
+    s->file_index = 1;
+    s = uring_sqe(r, 0, 1, IORING_OP_CLOSE);
+    s->file_index = 1;
+    if (uring_run(r) < 0 || r->res[0][0] < 0 || r->res[0][1] < 0) goto unavailable;
+    
+    r->bufs = malloc((size_t)URING_BATCH * URING_BUF);
+    r->stx = malloc(URING_BATCH * sizeof(struct statx));
+    if (!r->bufs || !r->stx) goto fail;
+    atomic_store(&uring_state, 1);
+    return r;
+unavailable:
+    atomic_store(&uring_state, -1);
+fail:
+    uring_free(r);
+    return NULL;
+}
+
+// TREE COPY
+// Directories are walked concurrently on a work pool through openat-relative
+// fds, so there is no path length limit and no repeated path resolution. A
+// directory's fds stay open until the last task below it finishes; that is
+// also when its final mode is applied (it is created writable so children
+// can land in it). Large files are split into ranges copied in parallel.
+// A sizing pass over the same pool runs first so progress has a total.
+// With COPY_VERIFY every file, or every range of a split one, is read back
+// and hashed by the worker that wrote it, right after writing it.
+typedef struct {
+    Pool *pool;
+    atomic_llong bytes, total_bytes;
+    atomic_long files, total_files, dirs, errors;
+    atomic_int *item_fail;  // per root, set on any failure below it
+    Uring **rings;          // per worker, created on first use
+    int n_rings;
+    pthread_mutex_t current_lock;
+    char current[256];      // most recently started file, best effort
+    int move;               // COPY_MOVE: sources are removed as they complete
+    int verify;             // COPY_VERIFY: copies are read back and compared
+    int preserve;           // COPY_PRESERVE, or a move: metadata is carried over
+    const char **dst;       // destination of each root
+    char **vbufs;           // per worker aligned read buffer for verifying
+    atomic_long verified, mismatched;
+    pthread_mutex_t bad_lock;
+    EntryStore *bad;        // destination paths that failed verification
+} CopyJob;
+
+typedef struct CopyDir {
+    CopyJob *job;
+    struct CopyDir *parent;
+    int src_fd, dst_fd;     // dst_fd < 0 for the sizing pass
+    struct stat st;
+    char *name;             // source name in the parent, for removal on move
+    atomic_int refs;
+} CopyDir;
+
+typedef struct {
+    CopyJob *job;
+    CopyDir *parent;    // NULL: names are paths relative to the cwd
+    char *src, *dst;
+    int item, follow;
+} CopyTask;
+
+typedef struct CopySplit CopySplit;
+
+typedef struct {
+    CopySplit *f;
+    off_t off, len;
+} CopyChunk;
+
+struct CopySplit {
+    CopyJob *job;
+    CopyDir *parent;
+    char *src, *dst;
+    int src_fd, item;
+    struct stat st;
+    atomic_int refs, failed, mismatch;
+    CopyChunk chunks[];
+};
+
+int copy_workers = 0;   // 0: derive from the CPU count
+int copy_verify = 0;    // pastes read their copies back (COPY_VERIFY)
+
+int copy_worker_count() {
+    if (copy_workers > 0) return copy_workers;
+    int n = cpu_count();
+    return n > 32 ? 32 : n;
+}
+
+static inline int dir_src_fd(CopyDir *d) { return d ? d->src_fd : AT_FDCWD; }
+static inline int dir_dst_fd(CopyDir *d) { return d ? d->dst_fd : AT_FDCWD; }
+
+static void copy_failed(CopyJob *job, int item) {
+    atomic_fetch_add(&job->errors, 1);
+    atomic_store(&job->item_fail[item], 1);
+}
+
+// Skipped rather than waited for when another worker is publishing
+static void copy_current(CopyJob *job, const char *name) {
+    if (pthread_mutex_trylock(&job->current_lock) != 0) return;
+    snprintf(job->current, sizeof(job->current), "%s", name);
+    pthread_mutex_unlock(&job->current_lock);
+}
+
+// Ownership, mode, xattrs, and times last so nothing after them bumps the
+// mtime. Each step is best effort: ownership fails for non-root, for ids
+// unmapped in a user namespace and on some FUSE mounts, and the rest must
+// still land. chown precedes chmod because it clears set-id bits.
+static void copy_attrs(int in, int out, const struct stat *st) {
+    fchown(out, st->st_uid, st->st_gid);
+    fchmod(out, st->st_mode & 07777);
+    ssize_t len = flistxattr(in, NULL, 0);
+    char *names = len > 0 ? malloc(len) : NULL;
+    char *val = names ? malloc(XATTR_SIZE_MAX) : NULL;
+    if (val && (len = flistxattr(in, names, len)) > 0) {
+        for (char *k = names; k < names + len; k += strlen(k) + 1) {
+            ssize_t n = fgetxattr(in, k, val, XATTR_SIZE_MAX);
+            if (n >= 0) fsetxattr(out, k, val, n, 0);
+        }
+    }
+    free(val);
+    free(names);
+    struct timespec ts[2] = {st->st_atim, st->st_mtim};
+    futimens(out, ts);
+}
+
+static char *copy_verify_buf(CopyJob *job) {
+    if (pool_self != job->pool || !job->vbufs) return NULL;
+    char **b = &job->vbufs[pool_me];
+    if (!*b && posix_memalign((void **)b, VERIFY_ALIGN, RW_BUF_SIZE) != 0) *b = NULL;
+    return *b;
+}
+
+// Compares [off, off+len) of the copy with the source. The copy is opened
+// O_DIRECT so its data comes back from the device, not from the pages just
+// written; where the filesystem refuses that, it is synced and the range
+// dropped from the cache before reading instead. Big ranges leave the cache
+// afterwards on both sides, so verifying a large paste does not push out
+// everything else. Returns 1 on a match, 0 if they differ, -1 on errors.
+static int copy_verify_range(CopyJob *job, int in, int pdst, const char *dst, off_t off, off_t len) {
+    char *buf = copy_verify_buf(job);
+    if (!buf) return -1;
+    int direct = 1;
+    int out = openat(pdst, dst, O_RDONLY|O_CLOEXEC|O_NOFOLLOW|O_DIRECT);
+    if (out < 0 && errno == EINVAL) {
+        direct = 0;
+        out = openat(pdst, dst, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+    }
+    if (out < 0) return -1;
+    uint64_t hs = 0, hd = 0;
+    posix_fadvise(in, off, len, POSIX_FADV_SEQUENTIAL);
+    int res = verify_hash(in, off, len, buf, &hs);
+    if (res == 0 && direct && verify_hash(out, off, len, buf, &hd) < 0) {
+        // Some filesystems take O_DIRECT at open and refuse it on read
+        if (errno != EINVAL || fcntl(out, F_SETFL, 0) < 0) res = -1;
+        else direct = 0;
+    }
+    if (res == 0 && !direct) {
+        fdatasync(out);
+        posix_fadvise(out, off, len, POSIX_FADV_DONTNEED);
+        res = verify_hash(out, off, len, buf, &hd);
+    }
+    if (len >= VERIFY_DROP_MIN) {
+        posix_fadvise(in, off, len, POSIX_FADV_DONTNEED);
+        posix_fadvise(out, off, len, POSIX_FADV_DONTNEED);
+    }
+    close(out);
+    return res < 0 ? -1 : hs == hd;
+}
+
+// Records a copy that differs or could not be read back, by destination path
+static void copy_mismatch(CopyJob *job, CopyDir *parent, const char *dst, int item) {
+    copy_failed(job, item);
+    atomic_fetch_add(&job->mismatched, 1);
+    if (!job->bad) return;
+    // Built backwards from the name; a path too long keeps its tail
+    char path[MAX_PATH];
+    size_t pos = sizeof(path) - 1;
+    path[pos] = '\0';
+    const char *part = dst;
+    for (CopyDir *d = parent;; d = d->parent) {
+        size_t n = strlen(part);
+        if (n + 1 > pos) break;
+        pos -= n;
+        memcpy(path + pos, part, n);
+        if (!d) break;
+        path[--pos] = '/';
+        part = d->parent ? d->name : job->dst[item];
+    }
+    pthread_mutex_lock(&job->bad_lock);
+    store_push(job->bad, path + pos, sizeof(path) - 1 - pos, 0);
+    pthread_mutex_unlock(&job->bad_lock);
+}
+
+// Verifies a whole copied file; 0 if it matches
+static int copy_verified(CopyJob *job, CopyDir *parent, const char *dst, int in, off_t len, int item) {
+    if (copy_verify_range(job, in, dir_dst_fd(parent), dst, 0, len) == 1) {
+        atomic_fetch_add(&job->verified, 1);
+        return 0;
+    }
+    copy_mismatch(job, parent, dst, item);
+    return -1;
+}
+
+// A finished file takes the source's metadata if kept; for a move the source goes
+static void copy_file_done(CopyJob *job, CopyDir *parent, const char *src, int in, int out, const struct stat *st, int item) {
+    if (job->preserve) copy_attrs(in, out, st);
+    if (job->move && unlinkat(dir_src_fd(parent), src, 0) < 0) copy_failed(job, item);
+}
+
+static void copy_dir_release(CopyDir *d) {
+    while (d && atomic_fetch_sub(&d->refs, 1) == 1) {
+        CopyDir *parent = d->parent;
+        if (d->dst_fd >= 0) {
+            if (d->job->preserve) copy_attrs(d->src_fd, d->dst_fd, &d->st);
+            else fchmod(d->dst_fd, d->st.st_mode & 07777);
+            close(d->dst_fd);
+        }
+        close(d->src_fd);
+        // ENOTEMPTY means a child failed, which was already counted
+        if (d->dst_fd >= 0 && d->job->move && unlinkat(dir_src_fd(parent), d->name, AT_REMOVEDIR) < 0 && errno != ENOTEMPTY)
+            atomic_fetch_add(&d->job->errors, 1);
+        free(d->name);
+        free(d);
+        d = parent;
+    }
+}
+
+static void copy_chunk_run(Pool *pool, void *arg) {
+    (void)pool;
+    CopyChunk *c = arg;
+    CopySplit *f = c->f;
+    copy_meter = &f->job->bytes;
+    // A private descriptor per chunk: copy_range may fall back to sendfile, which moves the file position
+    int out = openat(dir_dst_fd(f->parent), f->dst, O_WRONLY|O_CLOEXEC);
+    if (out < 0 || copy_range(f->src_fd, out, c->off, c->len) < 0) {
+        copy_failed(f->job, f->item);
+        atomic_store(&f->failed, 1);
+    } else if (f->job->verify && copy_verify_range(f->job, f->src_fd, dir_dst_fd(f->parent), f->dst, c->off, c->len) != 1) {
+        atomic_store(&f->failed, 1);
+        if (!atomic_exchange(&f->mismatch, 1)) copy_mismatch(f->job, f->parent, f->dst, f->item);
+    }
+    if (atomic_fetch_sub(&f->refs, 1) == 1) {
+        if (out >= 0 && !atomic_load(&f->failed)) {
+            if (f->job->verify) atomic_fetch_add(&f->job->verified, 1);
+            copy_file_done(f->job, f->parent, f->src, f->src_fd, out, &f->st, f->item);
+        }
+        atomic_fetch_add(&f->job->files, 1);
+        close(f->src_fd);
+        copy_dir_release(f->parent);
+        free(f->src);
+        free(f->dst);
+        free(f);
+    }
+    if (out >= 0) close(out);
+}
+
+// Hands the open source file to chunk tasks, which take over in and the parent ref
+static int copy_split(CopyTask *t, int in, const struct stat *st) {
+    off_t size = st->st_size;
+    int n = (int)((size + COPY_SPLIT_CHUNK - 1) / COPY_SPLIT_CHUNK);
+    CopySplit *f = malloc(sizeof(CopySplit) + n * sizeof(CopyChunk));
+    char *src = f ? strdup(t->src) : NULL, *dst = src ? strdup(t->dst) : NULL;
+    if (!dst) { free(src); free(f); return -1; }
+    f->job = t->job;
+    f->parent = t->parent;
+    f->src = src;
+    f->dst = dst;
+    f->src_fd = in;
+    f->item = t->item;
+    f->st = *st;
+    atomic_init(&f->refs, n);
+    atomic_init(&f->failed, 0);
+    atomic_init(&f->mismatch, 0);
+    for (int k = 0; k < n; k++) {
+        off_t off = (off_t)k * COPY_SPLIT_CHUNK;
+        f->chunks[k] = (CopyChunk){f, off, size - off < COPY_SPLIT_CHUNK ? size - off : COPY_SPLIT_CHUNK};
+    }
+    for (int k = 0; k < n; k++) pool_submit(t->job->pool, copy_chunk_run, &f->chunks[k]);
+    return 0;
+}
+
+static void copy_task_run(Pool *pool, void *arg);
+
+static void copy_task_free(CopyTask *t) {
+    if (t->dst != t->src) free(t->dst);
+    free(t->src);
+    free(t);
+}
+
+// Queues a child of d; the task holds a reference on d until it finishes
+static int copy_submit(CopyJob *job, CopyDir *d, const char *name, int item, task_fn fn) {
+    CopyTask *t = malloc(sizeof(CopyTask));
+    char *s = strdup(name);
+    if (!t || !s) { free(t); free(s); return -1; }
+    *t = (CopyTask){job, d, s, s, item, 0};
+    atomic_fetch_add(&d->refs, 1);
+    pool_submit(job->pool, fn, t);
+    return 0;
+}
+
+// Regular files found while listing are grouped per directory and copied
+// through the worker's ring; whatever the ring leaves undone runs through
+// copy_task_run() like any other entry.
+typedef struct {
+    CopyJob *job;
+    CopyDir *dir;
+    int item, n;
+    char *names[URING_BATCH];
+} CopyBatch;
+
+static Uring *copy_ring(CopyJob *job) {
+    if (pool_self != job->pool || pool_me >= job->n_rings) return NULL;
+    Uring **r = &job->rings[pool_me];
+    if (!*r) *r = uring_create();
+    return *r && !(*r)->dead ? *r : NULL;
+}
+
+// Marks done[i] for every file the ring finished, successfully or not
+static void uring_copy_batch(Uring *r, CopyBatch *b, char *done) {
+    CopyJob *job = b->job;
+    for (int i = 0; i < b->n; i++) {
+        struct io_uring_sqe *s = uring_sqe(r, i, 0, IORING_OP_STATX);
+        s->fd = b->dir->src_fd;
+        s->addr = (uint64_t)(uintptr_t)b->names[i];
+        s->len = STATX_TYPE|STATX_MODE|STATX_SIZE;
+        s->statx_flags = AT_SYMLINK_NOFOLLOW;
+        s->off = (uint64_t)(uintptr_t)&r->stx[i];
+        // Hard links keep the chain going after a short read, so the slot is always closed
+        s = uring_sqe(r, i, 1, IORING_OP_OPENAT);
+        s->fd = b->dir->src_fd;
+        s->addr = (uint64_t)(uintptr_t)b->names[i];
+        s->open_flags = O_RDONLY|O_NOFOLLOW|O_CLOEXEC;
+        s->file_index = i + 1;
+        s->flags = IOSQE_IO_HARDLINK;
+        s = uring_sqe(r, i, 2, IORING_OP_READ);
+        s->fd = i;
+        s->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)i * URING_BUF);
+        s->len = URING_BUF;
+        s->flags = IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+        s = uring_sqe(r, i, 3, IORING_OP_CLOSE);
+        s->file_index = i + 1;
+    }
+    if (uring_run(r) < 0) return;
+    
+    int queued = 0;
+    for (int i = 0; i < b->n; i++) {
+        struct statx *x = &r->stx[i];
+        // Bigger than the buffer, not regular, or changed between statx and read
+        if (r->res[i][0] < 0 || r->res[i][1] < 0 || !S_ISREG(x->stx_mode) || x->stx_size >= URING_BUF
+            || r->res[i][2] != (int)x->stx_size) continue;
+        struct io_uring_sqe *s = uring_sqe(r, i, 1, IORING_OP_OPENAT);
+        s->fd = b->dir->dst_fd;
+        s->addr = (uint64_t)(uintptr_t)b->names[i];
+        s->open_flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+        s->len = x->stx_mode & 07777;
+        s->file_index = i + 1;
+        s->flags = IOSQE_IO_HARDLINK;
+        s = uring_sqe(r, i, 2, IORING_OP_WRITE);
+        s->fd = i;
+        s->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)i * URING_BUF);
+        s->len = x->stx_size;
+        s->flags = IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+        s = uring_sqe(r, i, 3, IORING_OP_CLOSE);
+        s->file_index = i + 1;
+        done[i] = 2;
+        queued++;
+    }
+    if (queued == 0) return;
+    if (uring_run(r) < 0) {
+        memset(done, 0, b->n);
+        return;
+    }
+    
+    for (int i = 0; i < b->n; i++) {
+        if (done[i] != 2) continue;
+        done[i] = 1;
+        if (r->res[i][1] < 0 || r->res[i][2] != (int)r->stx[i].stx_size || r->res[i][3] < 0) {
+            copy_failed(job, b->item);
+        } else {
+            atomic_fetch_add(&job->files, 1);
+            atomic_fetch_add(&job->bytes, r->stx[i].stx_size);
+        }
+    }
+}
+
+static void copy_batch_run(Pool *pool, void *arg) {
+    CopyBatch *b = arg;
+    char done[URING_BATCH] = {0};
+    Uring *r = copy_ring(b->job);
+    copy_current(b->job, b->names[0]);
+    if (r) uring_copy_batch(r, b, done);
+    for (int i = 0; i < b->n; i++) {
+        CopyTask *t = done[i] ? NULL : malloc(sizeof(CopyTask));
+        if (!t) {
+            if (!done[i]) copy_failed(b->job, b->item);
+            free(b->names[i]);
+            continue;
+        }
+        *t = (CopyTask){b->job, b->dir, b->names[i], b->names[i], b->item, 0};
+        atomic_fetch_add(&b->dir->refs, 1);
+        copy_task_run(pool, t);
+    }
+    copy_dir_release(b->dir);
+    free(b);
+}
+
+// Adds name to *bp, queueing the batch once full; -1 if it must go the plain way
+static int copy_batch_add(CopyBatch **bp, CopyJob *job, CopyDir *d, const char *name, int item) {
+    // The ring path neither carries metadata over nor verifies
+    if (job->preserve || job->verify || atomic_load(&uring_state) < 0) return -1;
+    if (!*bp) {
+        *bp = malloc(sizeof(CopyBatch));
+        if (!*bp) return -1;
+        (*bp)->job = job;
+        (*bp)->dir = d;
+        (*bp)->item = item;
+        (*bp)->n = 0;
+        atomic_fetch_add(&d->refs, 1);
+    }
+    CopyBatch *b = *bp;
+    if (!(b->names[b->n] = strdup(name))) return -1;
+    if (++b->n == URING_BATCH) {
+        pool_submit(job->pool, copy_batch_run, b);
+        *bp = NULL;
+    }
+    return 0;
+}
+
+static void copy_dir_run(CopyTask *t, const struct stat *st) {
+    CopyJob *job = t->job;
+    int psrc = dir_src_fd(t->parent), pdst = dir_dst_fd(t->parent);
+    if (mkdirat(pdst, t->dst, (st->st_mode & 07777) | S_IRWXU) < 0 && errno != EEXIST) {
+        copy_failed(job, t->item);
+        copy_dir_release(t->parent);
+        return;
+    }
+    CopyDir *d = malloc(sizeof(CopyDir));
+    char *buf = malloc(DENTS_FIRST_BUF), *name = strdup(t->src);
+    int sfd = openat(psrc, t->src, O_RDONLY|O_DIRECTORY|O_CLOEXEC|(t->follow ? 0 : O_NOFOLLOW));
+    int dfd = openat(pdst, t->dst, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+    if (!d || !buf || !name || sfd < 0 || dfd < 0) {
+        copy_failed(job, t->item);
+        if (sfd >= 0) close(sfd);
+        if (dfd >= 0) close(dfd);
+        free(d);
+        free(buf);
+        free(name);
+        copy_dir_release(t->parent);
+        return;
+    }
+    // The task's reference on the parent passes to d; d holds one for the listing itself
+    *d = (CopyDir){job, t->parent, sfd, dfd, *st, name};
+    atomic_init(&d->refs, 1);
+    atomic_fetch_add(&job->dirs, 1);
+    
+    CopyBatch *batch = NULL;
+    long nread;
+    while ((nread = syscall(SYS_getdents64, sfd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            if (de->d_type == DT_REG && copy_batch_add(&batch, job, d, de->d_name, t->item) == 0) continue;
+            if (copy_submit(job, d, de->d_name, t->item, copy_task_run) < 0) copy_failed(job, t->item);
+        }
+    }
+    if (nread < 0) copy_failed(job, t->item);
+    if (batch && batch->n > 0) {
+        pool_submit(job->pool, copy_batch_run, batch);
+    } else if (batch) {
+        copy_dir_release(d);
+        free(batch);
+    }
+    free(buf);
+    copy_dir_release(d);
+}
+
+static void copy_file_run(CopyTask *t) {
+    CopyJob *job = t->job;
+    int in = openat(dir_src_fd(t->parent), t->src, O_RDONLY|O_CLOEXEC|(t->follow ? 0 : O_NOFOLLOW));
+    struct stat st;
+    if (in < 0 || fstat(in, &st) < 0) {
+        copy_failed(job, t->item);
+        if (in >= 0) close(in);
+        copy_dir_release(t->parent);
+        return;
+    }
+    int out = openat(dir_dst_fd(t->parent), t->dst, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        copy_failed(job, t->item);
+        close(in);
+        copy_dir_release(t->parent);
+        return;
+    }
+    // Dense files too big to clone are split; sparse ones keep the hole-aware path
+    int res = 1;
+    if (S_ISREG(st.st_mode) && st.st_size >= COPY_SPLIT_MIN && (off_t)st.st_blocks * 512 >= st.st_size) {
+        res = ioctl(out, FICLONE, in) == 0 ? 0 : 1;
+        if (res && ftruncate(out, st.st_size) == 0) {
+            close(out);
+            if (copy_split(t, in, &st) == 0) return;
+            out = openat(dir_dst_fd(t->parent), t->dst, O_WRONLY|O_CLOEXEC);
+            if (out < 0) {
+                copy_failed(job, t->item);
+                close(in);
+                copy_dir_release(t->parent);
+                return;
+            }
+        }
+    }
+    if (res) res = copy_fd(in, out, &st);
+    else atomic_fetch_add(&job->bytes, st.st_size);
+    if (res < 0) copy_failed(job, t->item);
+    else if (!job->verify || copy_verified(job, t->parent, t->dst, in, st.st_size, t->item) == 0)
+        copy_file_done(job, t->parent, t->src, in, out, &st, t->item);
+    if (close(out) < 0) copy_failed(job, t->item);
+    close(in);
+    atomic_fetch_add(&job->files, 1);
+    copy_dir_release(t->parent);
+}
+
+static void copy_special_run(CopyTask *t, const struct stat *st) {
+    int pdst = dir_dst_fd(t->parent);
+    int res = -1;
+    if (S_ISLNK(st->st_mode)) {
+        char target[MAX_PATH];
+        ssize_t n = readlinkat(dir_src_fd(t->parent), t->src, target, sizeof(target) - 1);
+        if (n >= 0) {
+            target[n] = '\0';
+            res = symlinkat(target, pdst, t->dst);
+            if (res < 0 && errno == EEXIST && unlinkat(pdst, t->dst, 0) == 0) res = symlinkat(target, pdst, t->dst);
+        }
+    } else {
+        res = mknodat(pdst, t->dst, st->st_mode, st->st_rdev);
+    }
+    if (res == 0 && t->job->preserve) {
+        struct timespec ts[2] = {st->st_atim, st->st_mtim};
+        fchownat(pdst, t->dst, st->st_uid, st->st_gid, AT_SYMLINK_NOFOLLOW);
+        utimensat(pdst, t->dst, ts, AT_SYMLINK_NOFOLLOW);
+        if (t->job->move) res = unlinkat(dir_src_fd(t->parent), t->src, 0);
+    }
+    if (res < 0) copy_failed(t->job, t->item);
+    else atomic_fetch_add(&t->job->files, 1);
+    copy_dir_release(t->parent);
+}
+
+// Symlinks below a root are copied as links; a root itself is followed unless moved or preserved
+static void copy_task_run(Pool *pool, void *arg) {
+    (void)pool;
+    CopyTask *t = arg;
+    copy_meter = &t->job->bytes;
+    struct stat st;
+    if (fstatat(dir_src_fd(t->parent), t->src, &st, t->follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+        copy_failed(t->job, t->item);
+        copy_dir_release(t->parent);
+    } else if (S_ISDIR(st.st_mode)) {
+        copy_dir_run(t, &st);
+    } else if (S_ISREG(st.st_mode)) {
+        copy_current(t->job, t->src);
+        copy_file_run(t);
+    } else {
+        copy_special_run(t, &st);
+    }
+    copy_task_free(t);
+}
+
+// Sizing pass: regular files are stat'ed inline, subdirectories become tasks
+static void measure_task_run(Pool *pool, void *arg);
+
+static void measure_dir(CopyTask *t) {
+    CopyJob *job = t->job;
+    int fd = openat(dir_src_fd(t->parent), t->src, O_RDONLY|O_DIRECTORY|O_CLOEXEC|(t->follow ? 0 : O_NOFOLLOW));
+    CopyDir *d = fd >= 0 ? malloc(sizeof(CopyDir)) : NULL;
+    char *buf = d ? malloc(DENTS_FIRST_BUF) : NULL;
+    if (!buf) {
+        if (fd >= 0) close(fd);
+        free(d);
+        copy_dir_release(t->parent);
+        return;
+    }
+    *d = (CopyDir){job, t->parent, fd, -1};
+    atomic_init(&d->refs, 1);
+    
+    long nread;
+    while ((nread = syscall(SYS_getdents64, fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            if (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN) {
+                copy_submit(job, d, de->d_name, t->item, measure_task_run);
+                continue;
+            }
+            struct stat st;
+            atomic_fetch_add(&job->total_files, 1);
+            if (de->d_type == DT_REG && fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                atomic_fetch_add(&job->total_bytes, st.st_size);
+        }
+    }
+    free(buf);
+    copy_dir_release(d);
+}
+
+static void measure_task_run(Pool *pool, void *arg) {
+    (void)pool;
+    CopyTask *t = arg;
+    struct stat st;
+    if (fstatat(dir_src_fd(t->parent), t->src, &st, t->follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            measure_dir(t);
+            copy_task_free(t);
+            return;
+        }
+        atomic_fetch_add(&t->job->total_files, 1);
+        if (S_ISREG(st.st_mode)) atomic_fetch_add(&t->job->total_bytes, st.st_size);
+    }
+    copy_dir_release(t->parent);
+    copy_task_free(t);
+}
+
+static void copy_snapshot(CopyJob *job, CopyStats *cs, double t0) {
+    cs->bytes = atomic_load(&job->bytes);
+    cs->total_bytes = atomic_load(&job->total_bytes);
+    cs->files = atomic_load(&job->files);
+    cs->total_files = atomic_load(&job->total_files);
+    cs->dirs = atomic_load(&job->dirs);
+    cs->errors = atomic_load(&job->errors);
+    cs->verified = atomic_load(&job->verified);
+    cs->mismatched = atomic_load(&job->mismatched);
+    cs->seconds = (now_ms() - t0) / 1000.0;
+    if (cs->seconds <= 0) cs->seconds = 1e-3;
+    cs->bytes_per_sec = cs->bytes / cs->seconds;
+    cs->files_per_sec = cs->files / cs->seconds;
+    cs->eta = -1;
+    pthread_mutex_lock(&job->current_lock);
+    memcpy(cs->current, job->current, sizeof(cs->current));
+    pthread_mutex_unlock(&job->current_lock);
+}
+
+// Drains the pool; progress, if any, is called on this thread every PROGRESS_MS
+// with a smoothed rate, however many files complete in between
+static void copy_wait(CopyJob *job, CopyStats *cs, double t0, progress_fn progress) {
+    double rate = 0, last_t = now_ms();
+    long long last = atomic_load(&job->bytes);
+    while (!pool_wait(job->pool, progress ? PROGRESS_MS : -1)) {
+        copy_snapshot(job, cs, t0);
+        double now = now_ms();
+        if (!cs->measuring && now > last_t) {
+            double inst = (cs->bytes - last) * 1000.0 / (now - last_t);
+            rate = rate > 0 ? rate * 0.8 + inst * 0.2 : inst;
+            cs->bytes_per_sec = rate;
+            if (rate > 0 && cs->total_bytes >= cs->bytes) cs->eta = (cs->total_bytes - cs->bytes) / rate;
+        }
+        last = cs->bytes;
+        last_t = now;
+        progress(cs);
+    }
+}
+
+static void copy_roots(CopyJob *job, const char **src, const char **dst, int n, task_fn fn) {
+    for (int i = 0; i < n; i++) {
+        CopyTask *t = malloc(sizeof(CopyTask));
+        char *s = strdup(src[i]), *d = dst ? strdup(dst[i]) : s;
+        if (!t || !s || !d) {
+            free(t); free(s);
+            if (dst) free(d);
+            copy_failed(job, i);
+            continue;
+        }
+        *t = (CopyTask){job, NULL, s, d, i, !job->preserve};
+        pool_submit(job->pool, fn, t);
+    }
+}
+
+// Copies n roots concurrently. fail[i] is set for each root that had any
+// error; stats (optional) receives the totals. progress (optional) is called
+// from this thread, first while the sources are sized, then while copying.
+// With COPY_MOVE each source file is unlinked as soon as its copy is done,
+// so a cross-device move needs little more space than the largest file.
+// With COPY_VERIFY a file only counts as done, and a moved source is only
+// removed, once the copy reads back identical; bad (optional) receives the
+// destination path of each one that did not. COPY_PRESERVE keeps owner,
+// mode, xattrs and times as a move does, and copies root symlinks as links.
+// Returns 0 if all succeeded.
+int copy_tree(const char **src, const char **dst, int n, int flags, int *fail, CopyStats *stats, progress_fn progress, EntryStore *bad) {
+    CopyJob job = {0};
+    job.move = (flags & COPY_MOVE) != 0;
+    job.verify = (flags & COPY_VERIFY) != 0;
+    job.preserve = job.move || (flags & COPY_PRESERVE) != 0;
+    job.dst = dst;
+    job.bad = bad;
+    job.item_fail = calloc(n > 0 ? n : 1, sizeof(atomic_int));
+    job.pool = job.item_fail ? pool_create(copy_worker_count()) : NULL;
+    job.rings = job.pool ? calloc(job.pool->n, sizeof(Uring *)) : NULL;
+    job.n_rings = job.rings ? job.pool->n : 0;
+    job.vbufs = job.pool && job.verify ? calloc(job.pool->n, sizeof(char *)) : NULL;
+    if (!job.pool || (job.verify && !job.vbufs)) {
+        pool_destroy(job.pool);
+        free(job.rings);
+        free(job.item_fail);
+        for (int i = 0; fail && i < n; i++) fail[i] = 1;
+        return -1;
+    }
+    pthread_mutex_init(&job.current_lock, NULL);
+    pthread_mutex_init(&job.bad_lock, NULL);
+    CopyStats cs = {0};
+    double t0 = now_ms();
+    if (progress) {
+        cs.measuring = 1;
+        copy_roots(&job, src, NULL, n, measure_task_run);
+        copy_wait(&job, &cs, t0, progress);
+        atomic_store(&job.errors, 0);
+        memset(job.item_fail, 0, n * sizeof(atomic_int));
+        cs.measuring = 0;
+        t0 = now_ms();
+    }
+    copy_roots(&job, src, dst, n, copy_task_run);
+    copy_wait(&job, &cs, t0, progress);
+    for (int i = 0; job.vbufs && i < job.pool->n; i++) free(job.vbufs[i]);
+    free(job.vbufs);
+    pool_destroy(job.pool);
+    for (int i = 0; i < job.n_rings; i++) uring_free(job.rings[i]);
+    free(job.rings);
+    
+    copy_snapshot(&job, &cs, t0);
+    if (stats) *stats = cs;
+    pthread_mutex_destroy(&job.current_lock);
+    pthread_mutex_destroy(&job.bad_lock);
+    int res = 0;
+    for (int i = 0; i < n; i++) {
+        if (fail) fail[i] = atomic_load(&job.item_fail[i]);
+        if (atomic_load(&job.item_fail[i])) res = -1;
+    }
+    free(job.item_fail);
+    return res;
+}
+
+int copy_dir_recursive(const char *src, const char *dst) {
+    return copy_tree(&src, &dst, 1, 0, NULL, NULL, NULL, NULL);
+}
+
+// TREE DELETE
+// Same shape as the copier: every directory is opened relative to its
+// parent's fd, children that are not directories are unlinked while it is
+// listed, subdirectories fan out as pool tasks, and the directory itself is
+// removed with unlinkat(AT_REMOVEDIR) once the last task below it finishes.
+// The paths given are unlinked REMOVE_BATCH to a task, a directory among
+// them being found by EISDIR rather than a stat per path. Nothing is ever
+// followed: a symlink, even a root one, is removed as a link.
+#define REMOVE_BATCH 256
+
+typedef struct {
+    Pool *pool;
+    int root_fd;                // the paths are relative to it
+    const char **paths;
+    int n;
+    atomic_long removed, errors;
+    atomic_int *item_fail;
+    pthread_mutex_t current_lock;
+    char current[256];
+} RemoveJob;
+
+typedef struct RemoveDir {
+    RemoveJob *job;
+    struct RemoveDir *parent;   // NULL: name is a path relative to job->root_fd
+    char *name;
+    int fd, item;
+    atomic_int refs;
+} RemoveDir;
+
+typedef struct {
+    RemoveJob *job;
+    int first;                  // of up to REMOVE_BATCH paths
+} RemoveBatch;
+
+static void remove_failed(RemoveJob *job, int item) {
+    atomic_fetch_add(&job->errors, 1);
+    atomic_store(&job->item_fail[item], 1);
+}
+
+static void remove_dir_release(RemoveDir *d) {
+    while (d && atomic_fetch_sub(&d->refs, 1) == 1) {
+        RemoveDir *parent = d->parent;
+        close(d->fd);
+        if (unlinkat(parent ? parent->fd : d->job->root_fd, d->name, AT_REMOVEDIR) == 0) atomic_fetch_add(&d->job->removed, 1);
+        else remove_failed(d->job, d->item);
+        free(d->name);
+        free(d);
+        d = parent;
+    }
+}
+
+// arg is a RemoveDir with refs == 1 and fd not yet open; the task owns it
+static void remove_dir_run(Pool *pool, void *arg) {
+    RemoveDir *d = arg;
+    RemoveJob *job = d->job;
+    d->fd = openat(d->parent ? d->parent->fd : job->root_fd, d->name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    char *buf = d->fd >= 0 ? malloc(DENTS_FIRST_BUF) : NULL;
+    if (!buf) {
+        remove_failed(job, d->item);
+        if (d->fd >= 0) close(d->fd);
+        RemoveDir *parent = d->parent;
+        free(d->name);
+        free(d);
+        remove_dir_release(parent);
+        return;
+    }
+    if (pthread_mutex_trylock(&job->current_lock) == 0) {
+        snprintf(job->current, sizeof(job->current), "%s", d->name);
+        pthread_mutex_unlock(&job->current_lock);
+    }
+    
+    long nread;
+    while ((nread = syscall(SYS_getdents64, d->fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            int is_dir = de->d_type == DT_DIR;
+            if (de->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(d->fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (!is_dir) {
+                if (unlinkat(d->fd, de->d_name, 0) == 0) atomic_fetch_add(&job->removed, 1);
+                else remove_failed(job, d->item);
+                continue;
+            }
+            RemoveDir *c = malloc(sizeof(RemoveDir));
+            char *name = c ? strdup(de->d_name) : NULL;
+            if (!name) {
+                free(c);
+                remove_failed(job, d->item);
+                continue;
+            }
+            *c = (RemoveDir){job, d, name, -1, d->item};
+            atomic_init(&c->refs, 1);
+            atomic_fetch_add(&d->refs, 1);
+            pool_submit(pool, remove_dir_run, c);
+        }
+    }
+    if (nread < 0) remove_failed(job, d->item);
+    free(buf);
+    remove_dir_release(d);
+}
+
+static void remove_snapshot(RemoveJob *job, RemoveStats *rs, double t0) {
+    rs->removed = atomic_load(&job->removed);
+    rs->errors = atomic_load(&job->errors);
+    rs->seconds = (now_ms() - t0) / 1000.0;
+    if (rs->seconds <= 0) rs->seconds = 1e-3;
+    rs->per_sec = rs->removed / rs->seconds;
+    pthread_mutex_lock(&job->current_lock);
+    memcpy(rs->current, job->current, sizeof(rs->current));
+    pthread_mutex_unlock(&job->current_lock);
+}
+
+static void remove_batch_run(Pool *pool, void *arg) {
+    RemoveBatch *b = arg;
+    RemoveJob *job = b->job;
+    int first = b->first;
+    free(b);
+    if (pthread_mutex_trylock(&job->current_lock) == 0) {
+        snprintf(job->current, sizeof(job->current), "%s", job->paths[first]);
+        pthread_mutex_unlock(&job->current_lock);
+    }
+    for (int i = first; i < job->n && i < first + REMOVE_BATCH; i++) {
+        if (unlinkat(job->root_fd, job->paths[i], 0) == 0) { atomic_fetch_add(&job->removed, 1); continue; }
+        if (errno != EISDIR) { remove_failed(job, i); continue; }
+        RemoveDir *d = malloc(sizeof(RemoveDir));
+        char *name = d ? strdup(job->paths[i]) : NULL;
+        if (!name) {
+            free(d);
+            remove_failed(job, i);
+            continue;
+        }
+        *d = (RemoveDir){job, NULL, name, -1, i};
+        atomic_init(&d->refs, 1);
+        pool_submit(pool, remove_dir_run, d);
+    }
+}
+
+// Removes n paths relative to root_fd concurrently; the contract matches
+// copy_tree()
+static int remove_tree_at(int root_fd, const char **paths, int n, int *fail, RemoveStats *stats, remove_progress_fn progress) {
+    RemoveJob job = {0};
+    job.root_fd = root_fd;
+    job.paths = paths;
+    job.n = n;
+    job.item_fail = calloc(n > 0 ? n : 1, sizeof(atomic_int));
+    job.pool = job.item_fail ? pool_create(copy_worker_count()) : NULL;
+    if (!job.pool) {
+        free(job.item_fail);
+        for (int i = 0; fail && i < n; i++) fail[i] = 1;
+        return -1;
+    }
+    pthread_mutex_init(&job.current_lock, NULL);
+    double t0 = now_ms();
+    for (int i = 0; i < n; i += REMOVE_BATCH) {
+        RemoveBatch *b = malloc(sizeof(RemoveBatch));
+        if (!b) {
+            for (int k = i; k < n && k < i + REMOVE_BATCH; k++) remove_failed(&job, k);
+            continue;
+        }
+        *b = (RemoveBatch){&job, i};
+        pool_submit(job.pool, remove_batch_run, b);
+    }
+    RemoveStats rs = {0};
+    while (!pool_wait(job.pool, progress ? PROGRESS_MS : -1)) {
+        remove_snapshot(&job, &rs, t0);
+        progress(&rs);
+    }
+    pool_destroy(job.pool);
+    
+    remove_snapshot(&job, &rs, t0);
+    if (stats) *stats = rs;
+    pthread_mutex_destroy(&job.current_lock);
+    int res = 0;
+    for (int i = 0; i < n; i++) {
+        if (fail) fail[i] = atomic_load(&job.item_fail[i]);
+        if (atomic_load(&job.item_fail[i])) res = -1;
+    }
+    free(job.item_fail);
+    return res;
+}
+
+int remove_tree(const char **paths, int n, int *fail, RemoveStats *stats, remove_progress_fn progress) {
+    return remove_tree_at(AT_FDCWD, paths, n, fail, stats, progress);
+}
+
+int remove_recursive(const char *path) {
+    return remove_tree(&path, 1, NULL, NULL, NULL);
+}
+
+// BACKGROUND DELETE
+// The UI's delete: the entries confirmed together are removed by
+// remove_tree_at() on a detached thread, relative to the directory they
+// were listed in, while the UI keeps running. Progress and the result
+// arrive as events.
+typedef struct {
+    EntryStore items;           // names relative to dir_fd
+    const char **paths;
+    int *fail;
+    int dir_fd;
+    char dir[MAX_PATH];
+} DeleteJob;
+
+typedef struct {
+    RemoveStats rs;
+    int done, items, failed;
+    char dir[MAX_PATH];
+} DeleteReport;
+
+static void delete_post_progress(const RemoveStats *rs) {
+    DeleteReport *r = calloc(1, sizeof(DeleteReport));
+    if (!r) return;
+    r->rs = *rs;
+    post_event(EV_DELETE_PROGRESS, 0, r);
+}
+
+static void *delete_worker(void *p) {
+    DeleteJob *job = p;
+    int n = job->items.count;
+    RemoveStats rs = {0};
+    remove_tree_at(job->dir_fd, job->paths, n, job->fail, &rs, delete_post_progress);
+    DeleteReport *r = calloc(1, sizeof(DeleteReport));
+    if (r) {
+        r->rs = rs;
+        r->done = 1;
+        r->items = n;
+        for (int i = 0; i < n; i++) r->failed += job->fail[i];
+        memcpy(r->dir, job->dir, sizeof(r->dir));
+    }
+    // Without a report the UI would wait forever; an empty one still ends the delete
+    post_event(EV_DELETE_DONE, 0, r);
+    close(job->dir_fd);
+    free(job->paths);
+    free(job->fail);
+    store_free(&job->items);
+    free(job);
+    return NULL;
+}
+
+// Removes items, named relative to the current directory, in the background
+int delete_start(const EntryStore *items) {
+    if (app.deleting) { status_error("Silme devam ediyor"); return 0; }
+    if (items->count == 0) return 0;
+    DeleteJob *job = calloc(1, sizeof(DeleteJob));
+    if (!job) { status_error("Bellek yetersiz: delete job"); return 0; }
+    job->dir_fd = open(app.current_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    snprintf(job->dir, sizeof(job->dir), "%s", app.current_dir);
+    int ok = job->dir_fd >= 0 && store_append(&job->items, items) &&
+             (job->paths = malloc(sizeof(char *) * items->count)) && (job->fail = calloc(items->count, sizeof(int)));
+    for (int i = 0; ok && i < job->items.count; i++) job->paths[i] = job->items.names + job->items.name_off[i];
+    pthread_t tid;
+    if (!ok || pthread_create(&tid, NULL, delete_worker, job) != 0) {
+        if (job->dir_fd < 0) status_error("Dizin acilamadi: %s", strerror(errno));
+        else status_error("Silme baslatilamadi");
+        if (job->dir_fd >= 0) close(job->dir_fd);
+        free(job->paths);
+        free(job->fail);
+        store_free(&job->items);
+        free(job);
+        return 0;
+    }
+    pthread_detach(tid);
+    app.deleting = 1;
+    status_info("%d oge siliniyor (%d is parcacigi)...", items->count, copy_worker_count());
+    return 1;
+}
+
+// Shows progress, or the result and the refreshed listing; returns 1 if the UI changed
+int delete_merge(Event *ev) {
+    DeleteReport *r = ev->data;
+    if (ev->type == EV_DELETE_PROGRESS) {
+        status_info("Siliniyor: %ld girdi | %.0f/s | %s", r->rs.removed, r->rs.per_sec, r->rs.current);
+    } else {
+        app.deleting = 0;
+        if (!r) status_error("Silme bitti, sonuc alinamadi");
+        else if (r->failed == 0) status_info("%d oge silindi | %ld girdi, %.0f/s", r->items, r->rs.removed, r->rs.per_sec);
+        else status_error("%d oge silindi, %d basarisiz", r->items - r->failed, r->failed);
+        if (!r || strcmp(r->dir, app.current_dir) == 0) refresh_listing();
+    }
+    free(r);
+    return 1;
+}
+
+// DIRECTORY SYNC
+// Brings a destination in line with a source, copying only what differs.
+// sync_plan() walks both trees at once on a work pool, directory pairs
+// through openat-relative fds as the copier does, and sorts each entry into
+// added, changed, unchanged or extra. A file is changed when its type, size
+// or mtime in whole seconds differs (rsync's quick check); with SYNC_HASH a
+// file of the same size is compared by content instead. Added and extra
+// directories are recorded once and walked on their one side for the totals.
+// sync_apply() copies with COPY_PRESERVE, so the copies carry the source
+// mtime and the next sync finds them unchanged. A changed file is copied to
+// a temporary name beside the old one and renamed over it, as rsync does,
+// so a failed copy leaves the old file; only an entry that changes type is
+// removed first. With SYNC_DELETE extra entries go once all copies landed.
+#define SIDE_SRC 1
+#define SIDE_DST 2
+#define SYNC_SWAP 0x40      // copy entry: replaces a file through a rename
+
+int sync_flags = 0;     // SYNC_HASH, SYNC_DELETE for the UI's sync
+
+typedef struct {
+    Pool *pool;
+    SyncPlan *plan;
+    pthread_mutex_t lock;       // the plan's stores
+    atomic_long added, changed, same, extra, dirs_added, dirs_extra, errors;
+    atomic_llong added_bytes, changed_bytes, extra_bytes, hashed_bytes;
+    char **bufs;                // per worker, for hashing
+} SyncJob;
+
+typedef struct SyncDir {
+    SyncJob *job;
+    struct SyncDir *parent;
+    int src_fd, dst_fd;         // -1: the side does not have this directory
+    char *rel;                  // path below the roots, "" for the roots
+    atomic_int refs;
+} SyncDir;
+
+typedef struct {
+    SyncJob *job;
+    SyncDir *parent;            // NULL: the names are the root paths
+    char *src, *dst, *rel;
+    int have;                   // SIDE_SRC|SIDE_DST
+    off_t size;                 // hash tasks: the size both sides share
+} SyncTask;
+
+static inline int sync_src_fd(SyncDir *d) { return d ? d->src_fd : AT_FDCWD; }
+static inline int sync_dst_fd(SyncDir *d) { return d ? d->dst_fd : AT_FDCWD; }
+
+static void sync_dir_release(SyncDir *d) {
+    while (d && atomic_fetch_sub(&d->refs, 1) == 1) {
+        SyncDir *parent = d->parent;
+        if (d->src_fd >= 0) close(d->src_fd);
+        if (d->dst_fd >= 0) close(d->dst_fd);
+        free(d->rel);
+        free(d);
+        d = parent;
+    }
+}
+
+static void sync_task_free(SyncTask *t) {
+    if (t->dst != t->src) free(t->dst);
+    free(t->src);
+    free(t->rel);
+    free(t);
+}
+
+static void sync_record(SyncJob *job, EntryStore *st, const char *rel, uint8_t flags) {
+    size_t len = strlen(rel);
+    pthread_mutex_lock(&job->lock);
+    if (len >= MAX_PATH || store_push(st, rel, len, flags) < 0) atomic_fetch_add(&job->errors, 1);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void sync_dir_run(Pool *pool, void *arg);
+static void sync_hash_run(Pool *pool, void *arg);
+
+// Queues a directory or hash task below parent, which it holds a reference on
+static void sync_submit(SyncJob *job, SyncDir *parent, const char *src, const char *dst, const char *rel, int have, off_t size, task_fn fn) {
+    SyncTask *t = malloc(sizeof(SyncTask));
+    char *s = strdup(src), *d = src == dst ? s : strdup(dst), *r = strdup(rel);
+    if (!t || !s || !d || !r) {
+        free(t); free(s); free(r);
+        if (d != s) free(d);
+        atomic_fetch_add(&job->errors, 1);
+        return;
+    }
+    *t = (SyncTask){job, parent, s, d, r, have, size};
+    if (parent) atomic_fetch_add(&parent->refs, 1);
+    pool_submit(job->pool, fn, t);
+}
+
+// A changed file is swapped in by sync_apply(); any other changed entry is
+// removed from the destination and copied again
+static void sync_changed(SyncJob *job, SyncDir *parent, const char *src, const char *rel, const struct stat *ss, const struct stat *ds) {
+    atomic_fetch_add(&job->changed, 1);
+    if (S_ISREG(ss->st_mode) && S_ISREG(ds->st_mode)) {
+        sync_record(job, &job->plan->copy, rel, SYNC_SWAP);
+        atomic_fetch_add(&job->changed_bytes, ss->st_size);
+        return;
+    }
+    sync_record(job, &job->plan->replace, rel, S_ISDIR(ds->st_mode) ? ENT_DIR : 0);
+    sync_record(job, &job->plan->copy, rel, S_ISDIR(ss->st_mode) ? ENT_DIR : 0);
+    if (S_ISDIR(ss->st_mode)) sync_submit(job, parent, src, src, rel, SIDE_SRC, 0, sync_dir_run);
+    else atomic_fetch_add(&job->changed_bytes, ss->st_size);
+}
+
+static int sync_link_differs(SyncDir *parent, const char *src, const char *dst) {
+    char a[MAX_PATH], b[MAX_PATH];
+    ssize_t la = readlinkat(sync_src_fd(parent), src, a, sizeof(a));
+    ssize_t lb = readlinkat(sync_dst_fd(parent), dst, b, sizeof(b));
+    return la < 0 || la != lb || memcmp(a, b, la) != 0;
+}
+
+// Classifies an entry present on the sides in have. Below a directory that
+// only one side has, entries are counted but not recorded.
+static void sync_entry(SyncJob *job, SyncDir *parent, const char *src, const char *dst, const char *rel, int have) {
+    struct stat ss, ds;
+    int record = !parent || (parent->src_fd >= 0 && parent->dst_fd >= 0);
+    if ((have & SIDE_SRC) && fstatat(sync_src_fd(parent), src, &ss, AT_SYMLINK_NOFOLLOW) < 0) {
+        if (errno != ENOENT) atomic_fetch_add(&job->errors, 1);
+        have &= ~SIDE_SRC;
+    }
+    if ((have & SIDE_DST) && fstatat(sync_dst_fd(parent), dst, &ds, AT_SYMLINK_NOFOLLOW) < 0) {
+        if (errno != ENOENT) atomic_fetch_add(&job->errors, 1);
+        have &= ~SIDE_DST;
+    }
+    if (have == SIDE_SRC) {
+        if (record) sync_record(job, &job->plan->copy, rel, S_ISDIR(ss.st_mode) ? ENT_DIR : 0);
+        if (S_ISDIR(ss.st_mode)) {
+            atomic_fetch_add(&job->dirs_added, 1);
+            sync_submit(job, parent, src, src, rel, SIDE_SRC, 0, sync_dir_run);
+        } else {
+            atomic_fetch_add(&job->added, 1);
+            atomic_fetch_add(&job->added_bytes, ss.st_size);
+        }
+    } else if (have == SIDE_DST) {
+        if (record) sync_record(job, &job->plan->extra, rel, S_ISDIR(ds.st_mode) ? ENT_DIR : 0);
+        if (S_ISDIR(ds.st_mode)) {
+            atomic_fetch_add(&job->dirs_extra, 1);
+            sync_submit(job, parent, dst, dst, rel, SIDE_DST, 0, sync_dir_run);
+        } else {
+            atomic_fetch_add(&job->extra, 1);
+            atomic_fetch_add(&job->extra_bytes, ds.st_size);
+        }
+    } else if (have) {
+        int changed;
+        if ((ss.st_mode & S_IFMT) != (ds.st_mode & S_IFMT)) {
+            changed = 1;
+        } else if (S_ISDIR(ss.st_mode)) {
+            sync_submit(job, parent, src, dst, rel, SIDE_SRC|SIDE_DST, 0, sync_dir_run);
+            return;
+        } else if (S_ISREG(ss.st_mode)) {
+            if (ss.st_size == ds.st_size && (job->plan->flags & SYNC_HASH)) {
+                sync_submit(job, parent, src, dst, rel, SIDE_SRC|SIDE_DST, ss.st_size, sync_hash_run);
+                return;
+            }
+            changed = ss.st_size != ds.st_size || ss.st_mtim.tv_sec != ds.st_mtim.tv_sec;
+        } else if (S_ISLNK(ss.st_mode)) {
+            changed = sync_link_differs(parent, src, dst);
+        } else {
+            changed = ss.st_rdev != ds.st_rdev;
+        }
+        if (changed) sync_changed(job, parent, src, rel, &ss, &ds);
+        else atomic_fetch_add(&job->same, 1);
+    }
+}
+
+static int sync_name_cmp(const void *a, const void *b, void *ctx) {
+    const EntryStore *st = ctx;
+    return strcmp(st->names + st->name_off[*(const int *)a], st->names + st->name_off[*(const int *)b]);
+}
+
+// Reads a directory's names, sorted, into st and order; 0 on failure
+static int sync_read_dir(int fd, EntryStore *st, int **order) {
+    char *buf = malloc(DENTS_FIRST_BUF);
+    if (!buf) return 0;
+    long nread;
+    int ok = 1;
+    while (ok && (nread = syscall(SYS_getdents64, fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread && ok;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            ok = store_push(st, de->d_name, strlen(de->d_name), 0) >= 0;
+        }
+    }
+    free(buf);
+    if (!ok || nread < 0) return 0;
+    *order = malloc(sizeof(int) * (st->count ? st->count : 1));
+    if (!*order) return 0;
+    for (int i = 0; i < st->count; i++) (*order)[i] = i;
+    qsort_r(*order, st->count, sizeof(int), sync_name_cmp, st);
+    return 1;
+}
+
+// Lists a directory pair, or one side of one, and merges the sorted listings
+static void sync_dir_run(Pool *pool, void *arg) {
+    (void)pool;
+    SyncTask *t = arg;
+    SyncJob *job = t->job;
+    SyncDir *d = malloc(sizeof(SyncDir));
+    int sfd = (t->have & SIDE_SRC) ? openat(sync_src_fd(t->parent), t->src, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW) : -1;
+    int dfd = (t->have & SIDE_DST) ? openat(sync_dst_fd(t->parent), t->dst, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW) : -1;
+    if (!d || ((t->have & SIDE_SRC) && sfd < 0) || ((t->have & SIDE_DST) && dfd < 0)) {
+        atomic_fetch_add(&job->errors, 1);
+        if (sfd >= 0) close(sfd);
+        if (dfd >= 0) close(dfd);
+        free(d);
+        sync_dir_release(t->parent);
+        sync_task_free(t);
+        return;
+    }
+    // The task's reference on the parent passes to d; d holds one for the listing itself
+    *d = (SyncDir){job, t->parent, sfd, dfd, t->rel};
+    atomic_init(&d->refs, 1);
+    t->rel = NULL;
+    
+    EntryStore ls = {0}, ld = {0};
+    int *os = NULL, *od = NULL;
+    if ((sfd >= 0 && !sync_read_dir(sfd, &ls, &os)) || (dfd >= 0 && !sync_read_dir(dfd, &ld, &od))) {
+        atomic_fetch_add(&job->errors, 1);
+    } else {
+        char rel[MAX_PATH];
+        for (int i = 0, j = 0; i < ls.count || j < ld.count;) {
+            const char *a = i < ls.count ? ls.names + ls.name_off[os[i]] : NULL;
+            const char *b = j < ld.count ? ld.names + ld.name_off[od[j]] : NULL;
+            int c = !a ? 1 : !b ? -1 : strcmp(a, b);
+            const char *name = c <= 0 ? a : b;
+            snprintf(rel, sizeof(rel), "%s%s%s", d->rel, d->rel[0] ? "/" : "", name);
+            sync_entry(job, d, name, name, rel, (c <= 0 ? SIDE_SRC : 0) | (c >= 0 ? SIDE_DST : 0));
+            if (c <= 0) i++;
+            if (c >= 0) j++;
+        }
+    }
+    store_free(&ls);
+    store_free(&ld);
+    free(os);
+    free(od);
+    sync_dir_release(d);
+    sync_task_free(t);
+}
+
+// Same-sized files under SYNC_HASH: XXH64 over both, big ones dropped from the cache after
+static void sync_hash_run(Pool *pool, void *arg) {
+    (void)pool;
+    SyncTask *t = arg;
+    SyncJob *job = t->job;
+    char **buf = job->bufs && pool_self == job->pool ? &job->bufs[pool_me] : NULL;
+    if (buf && !*buf) *buf = malloc(RW_BUF_SIZE);
+    int in = openat(sync_src_fd(t->parent), t->src, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+    int out = openat(sync_dst_fd(t->parent), t->dst, O_RDONLY|O_CLOEXEC|O_NOFOLLOW);
+    uint64_t hs, hd;
+    struct stat ss, ds;
+    if (!buf || !*buf || in < 0 || out < 0 || fstat(in, &ss) < 0 || fstat(out, &ds) < 0) {
+        atomic_fetch_add(&job->errors, 1);
+    } else {
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(out, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (verify_hash(in, 0, t->size, *buf, &hs) < 0 || verify_hash(out, 0, t->size, *buf, &hd) < 0) {
+            atomic_fetch_add(&job->errors, 1);
+        } else {
+            atomic_fetch_add(&job->hashed_bytes, 2 * t->size);
+            if (hs != hd) sync_changed(job, t->parent, t->src, t->rel, &ss, &ds);
+            else atomic_fetch_add(&job->same, 1);
+        }
+        if (t->size >= VERIFY_DROP_MIN) {
+            posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+            posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+        }
+    }
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    sync_dir_release(t->parent);
+    sync_task_free(t);
+}
+
+static void sync_snapshot(SyncJob *job, SyncStats *ss, double t0) {
+    ss->added = atomic_load(&job->added);
+    ss->changed = atomic_load(&job->changed);
+    ss->same = atomic_load(&job->same);
+    ss->extra = atomic_load(&job->extra);
+    ss->dirs_added = atomic_load(&job->dirs_added);
+    ss->dirs_extra = atomic_load(&job->dirs_extra);
+    ss->added_bytes = atomic_load(&job->added_bytes);
+    ss->changed_bytes = atomic_load(&job->changed_bytes);
+    ss->extra_bytes = atomic_load(&job->extra_bytes);
+    ss->hashed_bytes = atomic_load(&job->hashed_bytes);
+    ss->errors = atomic_load(&job->errors);
+    ss->seconds = (now_ms() - t0) / 1000.0;
+}
+
+// Compares src with dst, which need not exist, into plan. progress
+// (optional) is called from this thread every PROGRESS_MS. Returns 0 if
+// both trees were read completely, -1 if the plan may be missing entries.
+int sync_plan(const char *src, const char *dst, int flags, SyncPlan *plan, sync_progress_fn progress) {
+    memset(plan, 0, sizeof(*plan));
+    plan->flags = flags;
+    snprintf(plan->src, sizeof(plan->src), "%s", src);
+    snprintf(plan->dst, sizeof(plan->dst), "%s", dst);
+    struct stat st;
+    if (lstat(src, &st) < 0) return -1;
+    
+    SyncJob job = {0};
+    job.plan = plan;
+    job.pool = pool_create(copy_worker_count());
+    job.bufs = job.pool && (flags & SYNC_HASH) ? calloc(job.pool->n, sizeof(char *)) : NULL;
+    if (!job.pool || ((flags & SYNC_HASH) && !job.bufs)) {
+        pool_destroy(job.pool);
+        return -1;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    double t0 = now_ms();
+    int have = SIDE_SRC | (lstat(dst, &st) == 0 ? SIDE_DST : 0);
+    sync_entry(&job, NULL, plan->src, plan->dst, "", have);
+    while (!pool_wait(job.pool, progress ? PROGRESS_MS : -1)) {
+        sync_snapshot(&job, &plan->stats, t0);
+        progress(&plan->stats);
+    }
+    for (int i = 0; job.bufs && i < job.pool->n; i++) free(job.bufs[i]);
+    free(job.bufs);
+    pool_destroy(job.pool);
+    pthread_mutex_destroy(&job.lock);
+    sync_snapshot(&job, &plan->stats, t0);
+    return plan->stats.errors ? -1 : 0;
+}
+
+// The destination (or source) path of a recorded entry
+static char *sync_path(const char *root, const EntryStore *st, int i) {
+    const char *rel = st->names + st->name_off[i];
+    size_t n = strlen(root) + st->name_len[i] + 2;
+    char *p = malloc(n);
+    if (p) snprintf(p, n, "%s%s%s", root, rel[0] ? "/" : "", rel);
+    return p;
+}
+
+// Removes the entries of st below the destination; returns the failures
+static int sync_remove(SyncPlan *plan, const EntryStore *st) {
+    if (st->count == 0) return 0;
+    char **paths = calloc(st->count, sizeof(char *));
+    int *fail = calloc(st->count, sizeof(int)), failed = 0;
+    if (!paths || !fail) {
+        free(paths);
+        free(fail);
+        return st->count;
+    }
+    for (int i = 0; i < st->count; i++) paths[i] = sync_path(plan->dst, st, i);
+    remove_tree((const char **)paths, st->count, fail, NULL, NULL);
+    for (int i = 0; i < st->count; i++) {
+        failed += fail[i] || !paths[i];
+        free(paths[i]);
+    }
+    free(paths);
+    free(fail);
+    return failed;
+}
+
+// Where a swapped file is copied first: a hidden name in the directory of
+// dst, so the rename over dst stays on one filesystem
+static char *sync_temp(const char *dst, int i) {
+    const char *slash = strrchr(dst, '/');
+    int dir = slash ? (int)(slash - dst) + 1 : 0;
+    size_t n = dir + 48;
+    char *p = malloc(n);
+    if (p) snprintf(p, n, "%.*s.drmsync-%d-%d", dir, dst, (int)getpid(), i);
+    return p;
+}
+
+// Verification failures recorded under a temporary name get the real one
+static void sync_bad_rename(EntryStore *bad, int from, char **tmps, char **finals, int n) {
+    if (bad->count == from) return;
+    EntryStore fixed = {0};
+    for (int i = 0; i < bad->count; i++) {
+        const char *p = bad->names + bad->name_off[i];
+        for (int j = 0; i >= from && j < n; j++) {
+            if (finals[j] && strcmp(p, tmps[j]) == 0) { p = finals[j]; break; }
+        }
+        if (store_push(&fixed, p, strlen(p), bad->flags[i]) < 0) { store_free(&fixed); return; }
+    }
+    store_free(bad);
+    *bad = fixed;
+}
+
+// Carries out a plan: entries that change type are removed and copied
+// again, changed files swapped in, added ones copied, then with
+// SYNC_DELETE the extra ones removed, unless a copy failed. copy_flags
+// (COPY_VERIFY) and the remaining arguments go to copy_tree(); stats is
+// cleared first. Returns the number of entries that failed or were left.
+int sync_apply(SyncPlan *plan, int copy_flags, CopyStats *stats, progress_fn progress, EntryStore *bad) {
+    if (stats) memset(stats, 0, sizeof(*stats));
+    int failed = sync_remove(plan, &plan->replace);
+    int n = plan->copy.count, k = 0, from = bad ? bad->count : 0;
+    char **srcs = calloc(n + 1, sizeof(char *)), **dsts = calloc(n + 1, sizeof(char *));
+    char **finals = calloc(n + 1, sizeof(char *));     // swapped files: where the copy goes in the end
+    int *fail = calloc(n + 1, sizeof(int));
+    if (!srcs || !dsts || !finals || !fail) {
+        failed += n;
+        n = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        srcs[k] = sync_path(plan->src, &plan->copy, i);
+        dsts[k] = sync_path(plan->dst, &plan->copy, i);
+        if (dsts[k] && (plan->copy.flags[i] & SYNC_SWAP)) {
+            finals[k] = dsts[k];
+            dsts[k] = sync_temp(finals[k], i);
+            if (dsts[k]) unlink(dsts[k]);     // a leftover of an interrupted run
+        }
+        if (srcs[k] && dsts[k]) { k++; continue; }
+        free(srcs[k]); free(dsts[k]); free(finals[k]);
+        srcs[k] = dsts[k] = finals[k] = NULL;
+        failed++;
+    }
+    if (k) copy_tree((const char **)srcs, (const char **)dsts, k, copy_flags | COPY_PRESERVE, fail, stats, progress, bad);
+    for (int i = 0; i < k; i++) {
+        // The old file only gives way to a copy that completed, and verified with COPY_VERIFY
+        if (finals[i] && (fail[i] || rename(dsts[i], finals[i]) < 0)) {
+            unlink(dsts[i]);
+            fail[i] = 1;
+        }
+        failed += fail[i];
+    }
+    if (bad) sync_bad_rename(bad, from, dsts, finals, k);
+    if (plan->flags & SYNC_DELETE) failed += failed ? plan->extra.count : sync_remove(plan, &plan->extra);
+    for (int i = 0; i < k; i++) {
+        free(srcs[i]);
+        free(dsts[i]);
+        free(finals[i]);
+    }
+    free(srcs);
+    free(dsts);
+    free(finals);
+    free(fail);
+    return failed;
+}
+
+void sync_plan_free(SyncPlan *plan) {
+    store_free(&plan->copy);
+    store_free(&plan->replace);
+    store_free(&plan->extra);
+}
+
+// DIRECTORY SIZES
+// Opt-in du: the directories of the listing are summed in the background on
+// a work pool, walked like the copier through openat-relative fds. Allocated
+// blocks are counted, an inode with several links once per scan, and other
+// filesystems are not entered. Every finished directory, subdirectories
+// included, is cached by device, inode and mtime; since an mtime only moves
+// with a directory's own entries, turning sizes off and on again drops the
+// cache for a full rescan.
+#define DU_CACHE_SLOTS 16384
+
+typedef struct {
+    uint64_t dev, ino;
+    int64_t mtime;
+    long long bytes;
+} DuCacheSlot;
+
+struct {
+    pthread_mutex_t lock;
+    DuCacheSlot slot[DU_CACHE_SLOTS];   // direct-mapped by device and inode
+} du_cache = {PTHREAD_MUTEX_INITIALIZER};
+
+typedef struct {
+    uint64_t dev, ino;
+} DuLink;
+
+typedef struct DuJob {
+    Pool *pool;
+    atomic_int cancel, refs;
+    unsigned gen;
+    int dir_fd;
+    int n;
+    int *entries;
+    char **names;
+    pthread_mutex_t links_lock;
+    DuLink *links;          // inodes with several links seen so far, ino 0: empty
+    size_t links_cap, links_used;
+} DuJob;
+
+typedef struct DuDir {
+    DuJob *job;
+    struct DuDir *parent;   // NULL: a listing entry, name relative to job->dir_fd
+    char *name;
+    int fd, entry;
+    uint64_t dev, ino;
+    int64_t mtime;
+    atomic_llong bytes;
+    atomic_int refs, partial;
+} DuDir;
+
+typedef struct {
+    int entry;
+    long long bytes;    // < 0: could not be read
+} DuResult;
+
+static inline uint64_t stx_dev(const struct statx *stx) {
+    return (uint64_t)stx->stx_dev_major << 32 | stx->stx_dev_minor;
+}
+
+static inline int64_t stx_mtime_ns(const struct statx *stx) {
+    return stx->stx_mtime.tv_sec * 1000000000LL + stx->stx_mtime.tv_nsec;
+}
+
+static DuCacheSlot *du_cache_slot(uint64_t dev, uint64_t ino) {
+    uint64_t h = (ino ^ dev * 0x9e3779b97f4a7c15ULL) * 0xff51afd7ed558ccdULL;
+    return &du_cache.slot[(h >> 32) & (DU_CACHE_SLOTS - 1)];
+}
+
+// Cached total for the directory, or -1
+static long long du_cache_get(uint64_t dev, uint64_t ino, int64_t mtime) {
+    pthread_mutex_lock(&du_cache.lock);
+    DuCacheSlot *s = du_cache_slot(dev, ino);
+    long long bytes = s->ino == ino && s->dev == dev && s->mtime == mtime ? s->bytes : -1;
+    pthread_mutex_unlock(&du_cache.lock);
+    return bytes;
+}
+
+static void du_cache_put(uint64_t dev, uint64_t ino, int64_t mtime, long long bytes) {
+    pthread_mutex_lock(&du_cache.lock);
+    *du_cache_slot(dev, ino) = (DuCacheSlot){dev, ino, mtime, bytes};
+    pthread_mutex_unlock(&du_cache.lock);
+}
+
+void du_cache_clear() {
+    pthread_mutex_lock(&du_cache.lock);
+    memset(du_cache.slot, 0, sizeof(du_cache.slot));
+    pthread_mutex_unlock(&du_cache.lock);
+}
+
+// 1 the first time an inode is seen in this scan
+static int du_link_first(DuJob *job, uint64_t dev, uint64_t ino) {
+    pthread_mutex_lock(&job->links_lock);
+    if ((job->links_used + 1) * 2 > job->links_cap) {
+        size_t cap = job->links_cap ? job->links_cap * 2 : 1024;
+        DuLink *t = calloc(cap, sizeof(DuLink));
+        if (!t) { pthread_mutex_unlock(&job->links_lock); return 1; }
+        for (size_t k = 0; k < job->links_cap; k++) {
+            if (!job->links[k].ino) continue;
+            size_t h = (job->links[k].ino * 0x9e3779b97f4a7c15ULL) & (cap - 1);
+            while (t[h].ino) h = (h + 1) & (cap - 1);
+            t[h] = job->links[k];
+        }
+        free(job->links);
+        job->links = t;
+        job->links_cap = cap;
+    }
+    size_t mask = job->links_cap - 1, h = (ino * 0x9e3779b97f4a7c15ULL) & mask;
+    int first = 1;
+    for (; job->links[h].ino; h = (h + 1) & mask) {
+        if (job->links[h].ino == ino && job->links[h].dev == dev) { first = 0; break; }
+    }
+    if (first) {
+        job->links[h] = (DuLink){dev, ino};
+        job->links_used++;
+    }
+    pthread_mutex_unlock(&job->links_lock);
+    return first;
+}
+
+void du_job_release(DuJob *job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    close(job->dir_fd);
+    for (int k = 0; k < job->n; k++) free(job->names[k]);
+    free(job->names);
+    free(job->entries);
+    free(job->links);
+    pthread_mutex_destroy(&job->links_lock);
+    free(job);
+}
+
+// A finished directory is cached unless something below it was unreadable,
+// then adds itself to its parent; a listing entry posts its total instead
+static void du_dir_release(DuDir *d) {
+    while (d && atomic_fetch_sub(&d->refs, 1) == 1) {
+        DuJob *job = d->job;
+        DuDir *parent = d->parent;
+        long long bytes = atomic_load(&d->bytes);
+        int partial = atomic_load(&d->partial);
+        if (d->fd >= 0) close(d->fd);
+        if (!atomic_load(&job->cancel)) {
+            if (!partial && d->ino) du_cache_put(d->dev, d->ino, d->mtime, bytes);
+            if (parent) {
+                atomic_fetch_add(&parent->bytes, bytes);
+                if (partial) atomic_store(&parent->partial, 1);
+            } else {
+                DuResult *r = malloc(sizeof(DuResult));
+                if (r) {
+                    *r = (DuResult){d->entry, d->ino ? bytes : -1};
+                    post_event(EV_DU_SIZE, job->gen, r);
+                }
+            }
+        }
+        free(d->name);
+        free(d);
+        d = parent;
+    }
+}
+
+// arg is a DuDir with refs == 1 and fd not yet open; the task owns it.
+// Subdirectories arrive with dev, ino and mtime filled in by their parent.
+static void du_dir_run(Pool *pool, void *arg) {
+    DuDir *d = arg;
+    DuJob *job = d->job;
+    if (atomic_load(&job->cancel)) { du_dir_release(d); return; }
+    if (!d->parent) {
+        // Listing entries are followed like stat() did for the listing
+        struct statx stx;
+        if (statx(job->dir_fd, d->name, AT_STATX_DONT_SYNC, STATX_INO|STATX_MTIME|STATX_BLOCKS, &stx) < 0) { du_dir_release(d); return; }
+        d->dev = stx_dev(&stx);
+        d->ino = stx.stx_ino;
+        d->mtime = stx_mtime_ns(&stx);
+        long long cached = du_cache_get(d->dev, d->ino, d->mtime);
+        if (cached >= 0) {
+            atomic_store(&d->bytes, cached);
+            du_dir_release(d);
+            return;
+        }
+        atomic_store(&d->bytes, (long long)stx.stx_blocks * 512);
+    }
+    d->fd = openat(d->parent ? d->parent->fd : job->dir_fd, d->name, O_RDONLY|O_DIRECTORY|O_CLOEXEC|(d->parent ? O_NOFOLLOW : 0));
+    char *buf = d->fd >= 0 ? malloc(DENTS_FIRST_BUF) : NULL;
+    if (!buf) {
+        atomic_store(&d->partial, 1);
+        if (!d->parent) d->ino = 0;
+        du_dir_release(d);
+        return;
+    }
+    
+    long long bytes = 0;
+    long nread;
+    while (!atomic_load(&job->cancel) && (nread = syscall(SYS_getdents64, d->fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+            struct statx stx;
+            if (statx(d->fd, de->d_name, AT_SYMLINK_NOFOLLOW|AT_STATX_DONT_SYNC,
+                      STATX_TYPE|STATX_NLINK|STATX_INO|STATX_MTIME|STATX_BLOCKS, &stx) < 0) {
+                atomic_store(&d->partial, 1);
+                continue;
+            }
+            if (!S_ISDIR(stx.stx_mode)) {
+                if (stx.stx_nlink < 2 || du_link_first(job, stx_dev(&stx), stx.stx_ino)) bytes += (long long)stx.stx_blocks * 512;
+                continue;
+            }
+            if (stx_dev(&stx) != d->dev) continue;
+            long long cached = du_cache_get(d->dev, stx.stx_ino, stx_mtime_ns(&stx));
+            if (cached >= 0) { bytes += cached; continue; }
+            DuDir *c = malloc(sizeof(DuDir));
+            char *name = c ? strdup(de->d_name) : NULL;
+            if (!name) {
+                free(c);
+                atomic_store(&d->partial, 1);
+                continue;
+            }
+            *c = (DuDir){job, d, name, -1, d->entry, d->dev, stx.stx_ino, stx_mtime_ns(&stx)};
+            atomic_init(&c->bytes, (long long)stx.stx_blocks * 512);
+            atomic_init(&c->refs, 1);
+            atomic_init(&c->partial, 0);
+            atomic_fetch_add(&d->refs, 1);
+            pool_submit(pool, du_dir_run, c);
+        }
+    }
+    if (nread < 0) atomic_store(&d->partial, 1);
+    atomic_fetch_add(&d->bytes, bytes);
+    free(buf);
+    du_dir_release(d);
+}
+
+// Owns one reference; the other belongs to app.du_job until the scan is
+// cancelled or its EV_DU_DONE arrives
+static void *du_worker(void *p) {
+    DuJob *job = p;
+    job->pool = pool_create(copy_worker_count());
+    // Queued last-first: workers take their newest task first, so the
+    // entries on screen are summed before the rest
+    for (int k = job->n - 1; job->pool && k >= 0; k--) {
+        DuDir *d = malloc(sizeof(DuDir));
+        if (!d) continue;
+        *d = (DuDir){job, NULL, job->names[k], -1, job->entries[k]};
+        job->names[k] = NULL;
+        atomic_init(&d->bytes, 0);
+        atomic_init(&d->refs, 1);
+        atomic_init(&d->partial, 0);
+        pool_submit(job->pool, du_dir_run, d);
+    }
+    if (job->pool) {
+        pool_wait(job->pool, -1);
+        pool_destroy(job->pool);
+    }
+    post_event(EV_DU_DONE, job->gen, NULL);
+    du_job_release(job);
+    return NULL;
+}
+
+void du_cancel() {
+    app.du_gen++;
+    if (!app.du_job) return;
+    atomic_store(&app.du_job->cancel, 1);
+    du_job_release(app.du_job);
+    app.du_job = NULL;
+}
+
+static int du_add_target(DuJob *job, int i) {
+    if (!ENT_IS(i, ENT_DIR) || ENT_IS(i, ENT_DELETED) || app.du[i] != -1 || strcmp(ENT_NAME(i), "..") == 0) return 1;
+    char *name = strdup(ENT_NAME(i));
+    if (!name) return 0;
+    app.du[i] = -3;     // queued, so later passes skip it; reset below
+    job->entries[job->n] = i;
+    job->names[job->n++] = name;
+    return 1;
+}
+
+// Sums every directory of the listing without a size yet: the current page
+// first, then the rest of the visible rows, then the filtered-out ones.
+// Restarts any scan already running.
+void du_start() {
+    du_cancel();
+    if (!du_enabled || app.loading || app.searching || app.dir_fd < 0) return;
+    if (app.du_n < app.st.count) {
+        long long *nd = safe_realloc(app.du, sizeof(long long) * app.st.count, "directory sizes");
+        if (!nd) return;
+        app.du = nd;
+        for (int i = app.du_n; i < app.st.count; i++) app.du[i] = -1;
+        app.du_n = app.st.count;
+    }
+    DuJob *job = calloc(1, sizeof(DuJob));
+    if (!job) return;
+    job->entries = malloc(sizeof(int) * (app.du_n ? app.du_n : 1));
+    job->names = malloc(sizeof(char *) * (app.du_n ? app.du_n : 1));
+    job->dir_fd = openat(app.dir_fd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    int ok = job->entries && job->names && job->dir_fd >= 0;
+    int page_end = app.page_start + PAGE_SIZE < app.n_visible ? app.page_start + PAGE_SIZE : app.n_visible;
+    for (int p = app.page_start; ok && p < page_end; p++) ok = du_add_target(job, app.vis[p]);
+    for (int p = 0; ok && p < app.n_visible; p++) ok = du_add_target(job, app.vis[p]);
+    for (int i = 0; ok && i < app.du_n; i++) ok = du_add_target(job, i);
+    for (int k = 0; k < job->n; k++) app.du[job->entries[k]] = -1;
+    
+    pthread_t tid;
+    if (ok && job->n > 0) {
+        job->gen = app.du_gen;
+        pthread_mutex_init(&job->links_lock, NULL);
+        atomic_init(&job->refs, 2);
+        if (pthread_create(&tid, NULL, du_worker, job) == 0) {
+            pthread_detach(tid);
+            app.du_job = job;
+            return;
+        }
+        pthread_mutex_destroy(&job->links_lock);
+    }
+    if (job->dir_fd >= 0) close(job->dir_fd);
+    for (int k = 0; k < job->n; k++) free(job->names[k]);
+    free(job->names);
+    free(job->entries);
+    free(job);
+}
+
+// Applies a finished size or the end of a scan; returns 1 if the UI changed
+int du_merge(Event *ev) {
+    if (ev->gen != app.du_gen) {
+        free(ev->data);
+        return 0;
+    }
+    if (ev->type == EV_DU_DONE) {
+        if (app.du_job) du_job_release(app.du_job);
+        app.du_job = NULL;
+        // Directories that appeared while the scan ran
+        if (app.du_n < app.st.count) du_start();
+        return 1;
+    }
+    DuResult *r = ev->data;
+    if (r->entry < app.du_n) app.du[r->entry] = r->bytes < 0 ? -2 : r->bytes;
+    free(r);
+    return 1;
+}
+
+void du_toggle() {
+    du_enabled = !du_enabled;
+    if (du_enabled) {
+        du_start();
+        return;
+    }
+    du_cancel();
+    du_cache_clear();
+    app.du_n = 0;
+}
+
+// SUBTREE SEARCH
+// Names under the current directory are matched by a work pool that walks
+// the tree like the copier, through openat-relative fds and d_type, so only
+// symlinks and filesystems without d_type cost a stat. Matches become the
+// listing, named by their path below the search root, and are collected
+// across workers so the UI gets one batch per SEARCH_POST_MS rather than
+// one per directory. The pattern is a case-insensitive substring, or a
+// glob when it holds *, ? or [.
+//
+// Content search (grep) reuses the walk: regular files are handed to the
+// pool GREP_TASK_FILES at a time, mapped and scanned with the ci_find
+// kernel, and a file is listed at its first match. Files whose first
+// GREP_PROBE bytes hold a NUL are taken as binary and skipped. Files over
+// GREP_SPLIT are cut into chunks scanned in parallel. Files under GREP_MAP
+// are cheaper to read than to map, and files that cannot be mapped
+// (procfs, some FUSE) are read too, through a buffer reused by the task.
+// A mapped file truncated mid-scan faults with SIGBUS; the scanning
+// worker jumps out of it and counts the file as unreadable.
+#define GREP_TASK_FILES 64
+#define GREP_MAP (256 * 1024)
+#define GREP_SPLIT ((size_t)16 << 20)
+#define GREP_PROBE 8192
+#define GREP_READ_BUF (1 << 20)
+
+typedef struct {
+    char buf[SEARCH_SKIP_LEN];
+    char *pat[SEARCH_SKIP_MAX];
+    int n;
+} SkipList;
+
+typedef struct SearchJob {
+    Pool *pool;
+    atomic_int cancel, refs;
+    unsigned gen;
+    int root_fd;
+    int depth;
+    int glob;
+    int content;                    // match file contents, not names
+    char pat[MAX_FILTER_LEN];       // folded unless glob
+    size_t plen;
+    SkipList skip;
+    EntryStore roots;               // content search over these entries only, if any
+    pthread_mutex_t lock;
+    EntryStore pending;             // matches not yet posted
+    long dirs, errors;
+    atomic_long files, binary;
+    atomic_llong bytes;
+    double t0, posted_ms;
+} SearchJob;
+
+typedef struct SearchDir {
+    SearchJob *job;
+    struct SearchDir *parent;       // NULL: the search root, read through job->root_fd
+    char *path;                     // below the root; "" for the root itself
+    const char *name;               // last component of path
+    int fd, depth;
+    atomic_int refs;
+} SearchDir;
+
+typedef struct {
+    EntryStore st;
+    int done;
+    long dirs, errors, files, binary;
+    long long bytes;
+    double elapsed_ms;
+} SearchBatch;
+
+typedef struct {
+    SearchDir *dir;                 // holds a reference for the openat()s
+    EntryStore files;
+} GrepTask;
+
+// A large file shared by its chunk tasks; the last one out lists it
+typedef struct {
+    SearchJob *job;
+    char *path;
+    size_t path_len;
+    char *map;
+    size_t size;
+    atomic_int found, failed, refs;
+} GrepFile;
+
+typedef struct {
+    GrepFile *f;
+    size_t off;
+} GrepChunk;
+
+void search_job_release(SearchJob *job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    close(job->root_fd);
+    store_free(&job->pending);
+    store_free(&job->roots);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+static void search_dir_release(SearchDir *d) {
+    while (d && atomic_fetch_sub(&d->refs, 1) == 1) {
+        SearchDir *parent = d->parent;
+        if (parent && d->fd >= 0) close(d->fd);
+        free(d->path);
+        free(d);
+        d = parent;
+    }
+}
+
+static int search_match(SearchJob *job, const char *name, size_t len) {
+    if (job->glob) return fnmatch(job->pat, name, FNM_CASEFOLD) == 0;
+    return len >= job->plen && ci_find(name, len, job->pat, job->plen) != NULL;
+}
+
+// Splits a comma-separated pattern list, trimming spaces
+static void skip_init(SkipList *sl, const char *list) {
+    snprintf(sl->buf, sizeof(sl->buf), "%s", list);
+    sl->n = 0;
+    char *save = NULL;
+    for (char *t = strtok_r(sl->buf, ",", &save); t && sl->n < SEARCH_SKIP_MAX; t = strtok_r(NULL, ",", &save)) {
+        while (*t == ' ') t++;
+        char *e = t + strlen(t);
+        while (e > t && e[-1] == ' ') *--e = '\0';
+        if (*t) sl->pat[sl->n++] = t;
+    }
+}
+
+static int skip_match(const SkipList *sl, const char *name) {
+    for (int k = 0; k < sl->n; k++) {
+        if (fnmatch(sl->pat[k], name, 0) == 0) return 1;
+    }
+    return 0;
+}
+
+// Path of name below the search root
+static char *search_path(const SearchDir *d, const char *name, size_t len, size_t *path_len) {
+    size_t plen = strlen(d->path);
+    char *path = malloc(plen + len + 2);
+    if (!path) return NULL;
+    if (plen) {
+        memcpy(path, d->path, plen);
+        path[plen] = '/';
+        memcpy(path + plen + 1, name, len + 1);
+    } else {
+        memcpy(path, name, len + 1);
+    }
+    *path_len = plen ? plen + 1 + len : len;
+    return path;
+}
+
+// Hands a task's matches to the shared batch and posts the batch when it
+// is full or due; the worker posts the rest with the final batch
+static void search_collect(SearchJob *job, EntryStore *found, int failed, int dirs) {
+    SearchBatch *b = NULL;
+    pthread_mutex_lock(&job->lock);
+    job->dirs += dirs;
+    job->errors += failed;
+    if (found->count && !store_append(&job->pending, found)) job->errors++;
+    double now = now_ms();
+    if (job->pending.count >= SEARCH_BATCH || (job->pending.count && now - job->posted_ms >= SEARCH_POST_MS)) {
+        b = calloc(1, sizeof(SearchBatch));
+        if (b) {
+            b->st = job->pending;
+            memset(&job->pending, 0, sizeof(job->pending));
+            job->posted_ms = now;
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+    store_free(found);
+    if (b) post_event(EV_SEARCH_BATCH, job->gen, b);
+}
+
+// Whether [p, p + n) holds the pattern. The kernels load up to 31 bytes
+// past their haystack, so they run over all but the last plen + 32 bytes
+// in place and the tail is copied into a padded buffer.
+static int grep_range(const SearchJob *job, const char *p, size_t n) {
+    size_t tail = job->plen + 32;
+    if (n > tail && ci_find(p, n - 33, job->pat, job->plen)) return 1;
+    char buf[MAX_FILTER_LEN + 32 + ARENA_PAD];
+    size_t k = n > tail ? tail : n;
+    memcpy(buf, p + n - k, k);
+    return ci_find(buf, k, job->pat, job->plen) != NULL;
+}
+
+static int grep_binary(const char *p, size_t n) {
+    return memchr(p, 0, n < GREP_PROBE ? n : GREP_PROBE) != NULL;
+}
+
+// For files without a usable mapping; the last plen - 1 bytes of each
+// block are kept so a match across blocks is still found
+static int grep_read(SearchJob *job, int fd, char **bufp) {
+    if (!*bufp) *bufp = malloc(GREP_READ_BUF + MAX_FILTER_LEN + ARENA_PAD);
+    char *buf = *bufp;
+    if (!buf) return -1;
+    size_t keep = 0;
+    long long total = 0;
+    int hit = 0;
+    ssize_t r;
+    while (!hit && !atomic_load(&job->cancel) && (r = read(fd, buf + keep, GREP_READ_BUF)) != 0) {
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            hit = -1;
+            break;
+        }
+        if (total == 0 && grep_binary(buf, r)) {
+            atomic_fetch_add(&job->binary, 1);
+            break;
+        }
+        total += r;
+        size_t n = keep + r;
+        hit = n >= job->plen && ci_find(buf, n, job->pat, job->plen) != NULL;
+        keep = job->plen - 1 < n ? job->plen - 1 : n;
+        memmove(buf, buf + n - keep, keep);
+    }
+    atomic_fetch_add(&job->bytes, total);
+    return hit;
+}
+
+// Set while a worker scans a mapping; SIGBUS elsewhere keeps its default
+static __thread sigjmp_buf *grep_bus;
+static pthread_once_t grep_bus_once = PTHREAD_ONCE_INIT;
+
+static void grep_bus_handler(int sig) {
+    if (grep_bus) siglongjmp(*grep_bus, 1);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void grep_bus_install(void) {
+    struct sigaction sa = {0};
+    sa.sa_handler = grep_bus_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+// Scans mapped bytes for the pattern, or with probe only checks them for
+// binary; -1 if pages went missing under the mapping
+static int grep_mapped(const SearchJob *job, const char *p, size_t n, int probe) {
+    sigjmp_buf env;
+    if (sigsetjmp(env, 1)) {
+        grep_bus = NULL;
+        return -1;
+    }
+    grep_bus = &env;
+    int r = probe ? grep_binary(p, n) : n >= job->plen && grep_range(job, p, n);
+    grep_bus = NULL;
+    return r;
+}
+
+static void grep_file_release(GrepFile *f) {
+    if (atomic_fetch_sub(&f->refs, 1) != 1) return;
+    munmap(f->map, f->size);
+    EntryStore found = {0};
+    int failed = atomic_load(&f->failed) ? 1 : atomic_load(&f->found) && store_push(&found, f->path, f->path_len, 0) < 0;
+    search_collect(f->job, &found, failed, 0);
+    free(f->path);
+    free(f);
+}
+
+static void grep_chunk_run(Pool *pool, void *arg) {
+    GrepChunk *c = arg;
+    GrepFile *f = c->f;
+    if (!atomic_load(&f->found) && !atomic_load(&f->job->cancel)) {
+        // Matches may start anywhere in the chunk, so it overlaps the next by plen - 1
+        size_t n = f->size - c->off;
+        if (n > GREP_SPLIT + f->job->plen - 1) n = GREP_SPLIT + f->job->plen - 1;
+        int hit = grep_mapped(f->job, f->map + c->off, n, 0);
+        if (hit < 0) atomic_store(&f->failed, 1);
+        else if (hit) atomic_store(&f->found, 1);
+    }
+    grep_file_release(f);
+    free(c);
+}
+
+// Queues the chunks of a large mapped file; takes over map and path
+static int grep_split(Pool *pool, SearchJob *job, char *map, size_t size, char *path, size_t path_len) {
+    GrepFile *f = malloc(sizeof(GrepFile));
+    if (!f) return 0;
+    *f = (GrepFile){job, path, path_len, map, size};
+    atomic_init(&f->found, 0);
+    atomic_init(&f->failed, 0);
+    atomic_init(&f->refs, 1);
+    for (size_t off = 0; off < size; off += GREP_SPLIT) {
+        GrepChunk *c = malloc(sizeof(GrepChunk));
+        if (!c) break;
+        *c = (GrepChunk){f, off};
+        atomic_fetch_add(&f->refs, 1);
+        pool_submit(pool, grep_chunk_run, c);
+    }
+    grep_file_release(f);
+    return 1;
+}
+
+// 1 if the file holds the pattern, 0 if not or not a regular file, -1 if
+// it could not be read. Large files go to grep_split and return 0 here.
+static int grep_file(Pool *pool, SearchJob *job, SearchDir *d, const char *name, size_t len, char **buf) {
+    // O_NONBLOCK: a fifo that slipped past d_type must not hang the worker
+    int fd = openat(d->fd, name, O_RDONLY|O_CLOEXEC|O_NOFOLLOW|O_NONBLOCK|O_NOATIME);
+    if (fd < 0 && errno == EPERM) fd = openat(d->fd, name, O_RDONLY|O_CLOEXEC|O_NOFOLLOW|O_NONBLOCK);
+    if (fd < 0) return errno == ELOOP ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) { close(fd); return 0; }
+    atomic_fetch_add(&job->files, 1);
+    if (st.st_size >= GREP_MAP) pthread_once(&grep_bus_once, grep_bus_install);
+    char *map = st.st_size >= GREP_MAP ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        int hit = grep_read(job, fd, buf);
+        close(fd);
+        return hit;
+    }
+    close(fd);
+    size_t size = st.st_size;
+    atomic_fetch_add(&job->bytes, size);
+    int binary = grep_mapped(job, map, size, 1);
+    if (binary) {
+        if (binary > 0) atomic_fetch_add(&job->binary, 1);
+        munmap(map, size);
+        return binary > 0 ? 0 : -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    if (size > GREP_SPLIT) {
+        size_t path_len;
+        char *path = search_path(d, name, len, &path_len);
+        if (path && grep_split(pool, job, map, size, path, path_len)) return 0;
+        free(path);
+    }
+    int hit = grep_mapped(job, map, size, 0);
+    munmap(map, size);
+    return hit;
+}
+
+static void grep_task_run(Pool *pool, void *arg) {
+    GrepTask *t = arg;
+    SearchDir *d = t->dir;
+    SearchJob *job = d->job;
+    EntryStore found = {0};
+    char *buf = NULL;
+    int failed = 0;
+    for (int i = 0; i < t->files.count && !atomic_load(&job->cancel); i++) {
+        const char *name = t->files.names + t->files.name_off[i];
+        size_t len = t->files.name_len[i];
+        int hit = grep_file(pool, job, d, name, len, &buf);
+        if (hit < 0) failed++;
+        if (hit <= 0) continue;
+        size_t path_len;
+        char *path = search_path(d, name, len, &path_len);
+        if (!path || store_push(&found, path, path_len, 0) < 0) failed++;
+        free(path);
+    }
+    free(buf);
+    search_collect(job, &found, failed, 0);
+    store_free(&t->files);
+    free(t);
+    search_dir_release(d);
+}
+
+// Adds a file to d's open task, queueing the task once it is full;
+// name == NULL flushes it
+static void grep_queue(Pool *pool, SearchDir *d, GrepTask **t, const char *name, size_t len) {
+    if (name && !*t) {
+        *t = calloc(1, sizeof(GrepTask));
+        if (!*t) return;
+        (*t)->dir = d;
+        atomic_fetch_add(&d->refs, 1);
+    }
+    if (name && store_push(&(*t)->files, name, len, 0) < 0) return;
+    if (*t && (!name || (*t)->files.count >= GREP_TASK_FILES)) {
+        pool_submit(pool, grep_task_run, *t);
+        *t = NULL;
+    }
+}
+
+// arg is a SearchDir with refs == 1; the task owns it and each queued
+// subdirectory or file task holds a reference, which keeps this fd open
+// for its openat()
+static void search_dir_run(Pool *pool, void *arg) {
+    SearchDir *d = arg;
+    SearchJob *job = d->job;
+    if (atomic_load(&job->cancel)) { search_dir_release(d); return; }
+    if (d->parent) d->fd = openat(d->parent->fd, d->name, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+    // ci_find may read past the end of a name, as it does in the arena
+    char *buf = d->fd >= 0 ? malloc(DENTS_FIRST_BUF + ARENA_PAD) : NULL;
+    EntryStore found = {0};
+    if (!buf) {
+        search_collect(job, &found, 1, 1);
+        search_dir_release(d);
+        return;
+    }
+    
+    int descend = job->depth == 0 || d->depth < job->depth, failed = 0;
+    GrepTask *task = NULL;
+    long nread;
+    while (!atomic_load(&job->cancel) && (nread = syscall(SYS_getdents64, d->fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            const char *name = de->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            int type = de->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                type = fstatat(d->fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0 ? DT_UNKNOWN :
+                       S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            int is_dir = type == DT_DIR;
+            size_t len = strlen(name);
+            if (job->content && type == DT_REG) grep_queue(pool, d, &task, name, len);
+            int match = !job->content && search_match(job, name, len);
+            int enter = is_dir && descend && !skip_match(&job->skip, name);
+            if (!match && !enter) continue;
+            
+            size_t path_len;
+            char *path = search_path(d, name, len, &path_len);
+            if (!path) { failed = 1; continue; }
+            if (match && store_push(&found, path, path_len, is_dir ? ENT_DIR : 0) < 0) failed = 1;
+            if (!enter) { free(path); continue; }
+            
+            SearchDir *c = malloc(sizeof(SearchDir));
+            if (!c) { free(path); failed = 1; continue; }
+            *c = (SearchDir){job, d, path, path + path_len - len, -1, d->depth + 1};
+            atomic_init(&c->refs, 1);
+            atomic_fetch_add(&d->refs, 1);
+            pool_submit(pool, search_dir_run, c);
+        }
+    }
+    if (nread < 0) failed = 1;
+    grep_queue(pool, d, &task, NULL, 0);
+    free(buf);
+    search_collect(job, &found, failed, 1);
+    search_dir_release(d);
+}
+
+// Content search over the selection: directories are walked as usual,
+// files go straight to tasks of the root
+static void grep_roots(SearchJob *job, SearchDir *root) {
+    GrepTask *task = NULL;
+    for (int i = 0; i < job->roots.count; i++) {
+        const char *name = job->roots.names + job->roots.name_off[i];
+        size_t len = job->roots.name_len[i];
+        if (!(job->roots.flags[i] & ENT_DIR)) {
+            grep_queue(job->pool, root, &task, name, len);
+            continue;
+        }
+        char *path = strndup(name, len);
+        SearchDir *c = path ? malloc(sizeof(SearchDir)) : NULL;
+        if (!c) {
+            free(path);
+            pthread_mutex_lock(&job->lock);
+            job->errors++;
+            pthread_mutex_unlock(&job->lock);
+            continue;
+        }
+        // The whole path is the name: openat() takes it relative to the
+        // root. Depth counts from each selected directory.
+        *c = (SearchDir){job, root, path, path, -1, 1};
+        atomic_init(&c->refs, 1);
+        atomic_fetch_add(&root->refs, 1);
+        pool_submit(job->pool, search_dir_run, c);
+    }
+    grep_queue(job->pool, root, &task, NULL, 0);
+    search_dir_release(root);
+}
+
+// Owns one reference; the other belongs to app.search_job until the search
+// is cancelled or its final batch arrives
+static void *search_worker(void *p) {
+    SearchJob *job = p;
+    job->pool = pool_create(copy_worker_count());
+    SearchDir *root = job->pool ? malloc(sizeof(SearchDir)) : NULL;
+    char *path = root ? strdup("") : NULL;
+    if (path) {
+        *root = (SearchDir){job, NULL, path, path, job->root_fd, 1};
+        atomic_init(&root->refs, 1);
+        if (job->roots.count) grep_roots(job, root);
+        else pool_submit(job->pool, search_dir_run, root);
+    } else {
+        free(root);
+        job->errors++;
+    }
+    if (job->pool) {
+        pool_wait(job->pool, -1);
+        pool_destroy(job->pool);
+    }
+    
+    SearchBatch *b = calloc(1, sizeof(SearchBatch));
+    if (b) {
+        pthread_mutex_lock(&job->lock);
+        b->st = job->pending;
+        memset(&job->pending, 0, sizeof(job->pending));
+        b->dirs = job->dirs;
+        b->errors = job->errors;
+        pthread_mutex_unlock(&job->lock);
+        b->files = atomic_load(&job->files);
+        b->binary = atomic_load(&job->binary);
+        b->bytes = atomic_load(&job->bytes);
+        b->done = 1;
+        b->elapsed_ms = now_ms() - job->t0;
+        if (atomic_load(&job->cancel)) {
+            store_free(&b->st);
+            free(b);
+        } else {
+            post_event(EV_SEARCH_BATCH, job->gen, b);
+        }
+    }
+    search_job_release(job);
+    return NULL;
+}
+
+void search_cancel() {
+    app.searching = 0;
+    if (!app.search_job) return;
+    atomic_store(&app.search_job->cancel, 1);
+    search_job_release(app.search_job);
+    app.search_job = NULL;
+}
+
+struct Index;
+static struct Index *index_covering(const char *path, uint32_t *dir);
+static void index_search(struct Index *ix, uint32_t scope, const char *pattern);
+
+// Empties the listing for results. The plain listing goes to the cache, so
+// leaving the results is instant.
+static void search_reset(const char *pattern) {
+    if (!app.search[0]) cache_store_current();
+    app.load_gen++;
+    load_cancel();
+    search_cancel();
+    name_index_free();
+    store_free(&app.st);
+    app.order_n = app.name_key_n = app.name_order_n = 0;
+    du_cancel();
+    app.du_n = 0;
+    // Results are not the directory's listing: no watch, nothing to cache
+    watch_stop();
+    app.loaded_dir[0] = '\0';
+    app.load_rate = 0;
+    app.filter_active = 0;
+    app.filter[0] = '\0';
+    apply_filter();
+    if (app.dir_fd < 0) app.dir_fd = open(app.current_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    snprintf(app.search, sizeof(app.search), "%s", pattern);
+    app.search_content = 0;
+}
+
+static SearchJob *search_job_new(const char *pattern, int content) {
+    SearchJob *job = calloc(1, sizeof(SearchJob));
+    if (!job) { status_error("Bellek yetersiz: search job"); return NULL; }
+    job->root_fd = app.dir_fd >= 0 ? openat(app.dir_fd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC)
+                                   : open(app.current_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (job->root_fd < 0) {
+        status_error("Dizin acilamadi: %s", strerror(errno));
+        free(job);
+        return NULL;
+    }
+    job->depth = search_depth;
+    job->content = content;
+    job->glob = !content && strpbrk(pattern, "*?[") != NULL;
+    snprintf(job->pat, sizeof(job->pat), "%s", pattern);
+    job->plen = strlen(job->pat);
+    if (!job->glob) {
+        for (size_t k = 0; k < job->plen; k++) job->pat[k] = fold_ascii(job->pat[k]);
+    }
+    skip_init(&job->skip, search_skip);
+    return job;
+}
+
+static int search_launch(SearchJob *job, const char *pattern) {
+    search_reset(pattern);
+    job->gen = app.load_gen;
+    job->t0 = job->posted_ms = now_ms();
+    pthread_mutex_init(&job->lock, NULL);
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->refs, 2);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, search_worker, job) != 0) {
+        close(job->root_fd);
+        pthread_mutex_destroy(&job->lock);
+        store_free(&job->roots);
+        free(job);
+        status_error("Arama baslatilamadi");
+        return 0;
+    }
+    pthread_detach(tid);
+    app.search_job = job;
+    app.searching = 1;
+    status_clear();
+    return 1;
+}
+
+// Replaces the listing with the matches below the current directory,
+// answered from a filename index when one covers it, else by a walk
+int search_start(const char *pattern) {
+    if (!pattern[0]) return 0;
+    uint32_t scope;
+    struct Index *ix = index_covering(app.current_dir, &scope);
+    if (ix) {
+        search_reset(pattern);
+        index_search(ix, scope, pattern);
+        return 1;
+    }
+    SearchJob *job = search_job_new(pattern, 0);
+    return job && search_launch(job, pattern);
+}
+
+// Selection the last content search ran over; a refresh runs it again
+EntryStore grep_scope;
+
+static int grep_begin(const char *pattern) {
+    SearchJob *job = search_job_new(pattern, 1);
+    if (!job) return 0;
+    if (grep_scope.count && !store_append(&job->roots, &grep_scope)) {
+        status_error("Bellek yetersiz: grep");
+        close(job->root_fd);
+        store_free(&job->roots);
+        free(job);
+        return 0;
+    }
+    if (!search_launch(job, pattern)) return 0;
+    app.search_content = 1;
+    return 1;
+}
+
+// Replaces the listing with the files below the current directory, or
+// below the selected entries, whose contents hold pattern
+int grep_start(const char *pattern) {
+    if (!pattern[0]) return 0;
+    store_free(&grep_scope);
+    for (int i = 0; i < app.st.count; i++) {
+        if ((app.st.flags[i] & (ENT_SELECTED|ENT_DELETED)) != ENT_SELECTED) continue;
+        if (store_push(&grep_scope, ENT_NAME(i), app.st.name_len[i], app.st.flags[i] & ENT_DIR) < 0) {
+            status_error("Bellek yetersiz: grep");
+            return 0;
+        }
+    }
+    return grep_begin(pattern);
+}
+
+// Merges a batch of matches; returns 1 if the UI changed
+int search_merge(Event *ev) {
+    SearchBatch *b = ev->data;
+    int changed = 0;
+    if (ev->gen == app.load_gen && app.searching) {
+        int from = app.st.count;
+        if (store_append(&app.st, &b->st)) filter_extend(from);
+        if (b->done) {
+            app.searching = 0;
+            app.load_ms = b->elapsed_ms;
+            app.load_rate = 0;
+            if (app.search_job) { search_job_release(app.search_job); app.search_job = NULL; }
+            resort_listing(app.highlight > 0);
+            double mb = b->bytes / 1048576.0, secs = b->elapsed_ms > 0 ? b->elapsed_ms / 1000 : 1e-3;
+            if (app.search_content && b->errors) status_error("%d dosya | %ld tarandi, %ld ikili, %ld okunamadi | %.1f MB, %.0f ms",
+                                                              app.st.count, b->files, b->binary, b->errors, mb, b->elapsed_ms);
+            else if (app.search_content) status_info("%d dosya | %ld tarandi, %ld ikili | %.1f MB, %.0f ms, %.0f MB/s",
+                                                     app.st.count, b->files, b->binary, mb, b->elapsed_ms, mb / secs);
+            else if (b->errors) status_error("%d sonuc | %ld dizin, %ld okunamadi | %.0f ms", app.st.count, b->dirs, b->errors, b->elapsed_ms);
+            else status_info("%d sonuc | %ld dizin | %.0f ms", app.st.count, b->dirs, b->elapsed_ms);
+            du_start();
+        }
+        changed = 1;
+    }
+    store_free(&b->st);
+    free(b);
+    return changed;
+}
+
+// FILENAME INDEX
+// A persistent index of every name below a chosen root, one file per root
+// in $XDG_CACHE_HOME/drmngr (~/.cache/drmngr), mapped read-only. After a
+// fixed header the file holds, native-endian:
+//   dirs   IdxDir[n_dirs]   breadth-first, the root first; each owns a
+//                           contiguous range of entries
+//   ents   IdxEnt[n_ents]   sorted by name (bytewise) within a directory
+//   names  NUL-terminated, in entry order, then ARENA_PAD zero bytes
+//   tris   IdxTri[n_tris]   folded trigrams in ascending order
+//   post   per trigram, ascending entry numbers as varint deltas
+// A query intersects the posting lists of its trigrams and checks the
+// survivors; patterns under three characters scan the names. A refresh
+// walks the tree again but takes the entries of every directory whose
+// inode and mtime are unchanged from the old file, so only directories
+// whose contents changed are read. Other filesystems are not entered.
+#define IDX_MAGIC "DRMIDX\r\n"
+#define IDX_VERSION 1
+#define IDX_NONE 0xffffffffu        // IdxEnt.child of a file
+#define IDX_UNREAD 0xfffffffeu      // IdxEnt.child of a directory not entered
+#define IDX_STALE_S 600
+#define IDX_WBUF (256 * 1024)
+
+typedef struct {
+    char magic[8];
+    uint32_t version, header_size;
+    uint64_t file_size;
+    int64_t built;                  // seconds since the epoch
+    uint32_t n_dirs, n_ents, n_tris, root_len;
+    uint64_t root_off, dirs_off, ents_off, names_off, names_len, tris_off, post_off, post_len;
+} IdxHeader;
+
+typedef struct {
+    uint32_t parent, ent;           // IDX_NONE for the root
+    uint32_t first, count;
+    uint64_t ino;
+    int64_t mtime;                  // ns
+} IdxDir;
+
+typedef struct {
+    uint32_t name_off, child;
+} IdxEnt;
+
+typedef struct {
+    uint32_t tri, count;
+    uint64_t off;
+} IdxTri;
+
+typedef struct Index {
+    char *root, *file;
+    uint8_t *map;
+    size_t size;
+    const IdxHeader *h;
+    const IdxDir *dirs;
+    const IdxEnt *ents;
+    const char *names;
+    const IdxTri *tris;
+    const uint8_t *post;
+    struct Index *next;
+} Index;
+
+Index *indexes = NULL;
+int indexes_loaded = 0;
+unsigned index_gen = 0;
+
+static int index_dir(char *buf, size_t n) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (xdg && xdg[0]) snprintf(buf, n, "%s/drmngr", xdg);
+    else if (home && home[0]) snprintf(buf, n, "%s/.cache/drmngr", home);
+    else return 0;
+    char *slash = strrchr(buf, '/');
+    *slash = '\0';
+    mkdir(buf, 0700);
+    *slash = '/';
+    return mkdir(buf, 0700) == 0 || errno == EEXIST;
+}
+
+static uint64_t fnv1a(const char *s, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t k = 0; k < n; k++) h = (h ^ (unsigned char)s[k]) * 1099511628211ULL;
+    return h;
+}
+
+static int index_file_for(const char *root, char *buf, size_t n) {
+    char dir[MAX_PATH];
+    if (!index_dir(dir, sizeof(dir))) return 0;
+    return snprintf(buf, n, "%s/%016llx.idx", dir, (unsigned long long)fnv1a(root, strlen(root))) < (int)n;
+}
+
+static int sec_ok(uint64_t off, uint64_t len, uint64_t size, int align) {
+    return off <= size && len <= size - off && off % align == 0;
+}
+
+// Checks everything a query relies on, so a damaged file is refused
+// rather than read out of bounds
+static int index_valid(Index *ix) {
+    const IdxHeader *h = (const IdxHeader *)ix->map;
+    if (memcmp(h->magic, IDX_MAGIC, 8) || h->version != IDX_VERSION || h->header_size != sizeof(IdxHeader) ||
+        h->file_size != ix->size || h->n_dirs == 0 || h->n_ents >= IDX_UNREAD) return 0;
+    if (!sec_ok(h->root_off, h->root_len + 1, ix->size, 1) ||
+        !sec_ok(h->dirs_off, (uint64_t)h->n_dirs * sizeof(IdxDir), ix->size, 8) ||
+        !sec_ok(h->ents_off, (uint64_t)h->n_ents * sizeof(IdxEnt), ix->size, 4) ||
+        !sec_ok(h->names_off, h->names_len + ARENA_PAD, ix->size, 1) ||
+        !sec_ok(h->tris_off, (uint64_t)h->n_tris * sizeof(IdxTri), ix->size, 8) ||
+        !sec_ok(h->post_off, h->post_len, ix->size, 1)) return 0;
+    ix->h = h;
+    ix->dirs = (const IdxDir *)(ix->map + h->dirs_off);
+    ix->ents = (const IdxEnt *)(ix->map + h->ents_off);
+    ix->names = (const char *)(ix->map + h->names_off);
+    ix->tris = (const IdxTri *)(ix->map + h->tris_off);
+    ix->post = ix->map + h->post_off;
+    if (ix->map[h->root_off + h->root_len] != '\0' || (h->n_ents && (!h->names_len || ix->names[h->names_len - 1]))) return 0;
+    
+    for (uint32_t e = 0; e < h->n_ents; e++) {
+        uint32_t end = e + 1 < h->n_ents ? ix->ents[e + 1].name_off : h->names_len;
+        if (ix->ents[e].name_off >= end || end > h->names_len || ix->names[end - 1]) return 0;
+        if (ix->ents[e].child < IDX_UNREAD && ix->ents[e].child >= h->n_dirs) return 0;
+    }
+    for (uint32_t d = 0; d < h->n_dirs; d++) {
+        const IdxDir *r = &ix->dirs[d];
+        // Parents come first, which also rules out cycles
+        if (d ? r->parent >= d || r->ent >= h->n_ents : r->parent != IDX_NONE) return 0;
+        if (r->first > h->n_ents || r->count > h->n_ents - r->first) return 0;
+        if (d && r->first < ix->dirs[d - 1].first) return 0;
+    }
+    for (uint32_t t = 0; t < h->n_tris; t++) {
+        if ((t && ix->tris[t].tri <= ix->tris[t - 1].tri) || ix->tris[t].off > h->post_len) return 0;
+    }
+    return 1;
+}
+
+static void index_close(Index *ix) {
+    if (!ix) return;
+    if (ix->map) munmap(ix->map, ix->size);
+    free(ix->root);
+    free(ix->file);
+    free(ix);
+}
+
+static Index *index_open(const char *file) {
+    int fd = open(file, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(IdxHeader)) map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    Index *ix = calloc(1, sizeof(Index));
+    if (!ix) { munmap(map, st.st_size); return NULL; }
+    ix->map = map;
+    ix->size = st.st_size;
+    if (!index_valid(ix) || !(ix->root = strdup((const char *)ix->map + ix->h->root_off)) || !(ix->file = strdup(file))) {
+        index_close(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+static void index_load_all() {
+    if (indexes_loaded) return;
+    indexes_loaded = 1;
+    char dir[MAX_PATH], file[MAX_PATH];
+    if (!index_dir(dir, sizeof(dir))) return;
+    DIR *dp = opendir(dir);
+    if (!dp) return;
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+        size_t len = strlen(de->d_name);
+        if (len < 5 || strcmp(de->d_name + len - 4, ".idx")) continue;
+        int n = snprintf(file, sizeof(file), "%s/%s", dir, de->d_name);
+        if (n < 0 || n >= (int)sizeof(file)) continue;   // not ours: we never write such names
+        Index *ix = index_open(file);
+        if (!ix) continue;
+        ix->next = indexes;
+        indexes = ix;
+    }
+    closedir(dp);
+}
+
+int index_count() {
+    index_load_all();
+    int n = 0;
+    for (Index *ix = indexes; ix; ix = ix->next) n++;
+    return n;
+}
+
+void index_close_all() {
+    while (indexes) {
+        Index *next = indexes->next;
+        index_close(indexes);
+        indexes = next;
+    }
+    indexes_loaded = 0;
+}
+
+static inline size_t idx_name_len(const Index *ix, uint32_t e) {
+    uint32_t end = e + 1 < ix->h->n_ents ? ix->ents[e + 1].name_off : ix->h->names_len;
+    return end - ix->ents[e].name_off - 1;
+}
+
+// Directory owning entry e: the last one whose range starts at or before it
+static uint32_t idx_dir_of(const Index *ix, uint32_t e) {
+    uint32_t lo = 0, hi = ix->h->n_dirs - 1;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (ix->dirs[mid].first <= e) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// Entry called name in directory d, or IDX_NONE
+static uint32_t idx_lookup(const Index *ix, const IdxDir *d, const char *name, size_t len) {
+    uint32_t lo = d->first, hi = d->first + d->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *s = ix->names + ix->ents[mid].name_off;
+        int c = strncmp(s, name, len);
+        if (c == 0 && s[len]) c = 1;
+        if (c == 0) return mid;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return IDX_NONE;
+}
+
+// Directory of the index at path, or IDX_NONE when the index does not reach it
+static uint32_t index_find_dir(const Index *ix, const char *path) {
+    size_t rl = strlen(ix->root);
+    if (strcmp(ix->root, "/") != 0) {
+        if (strncmp(path, ix->root, rl) != 0 || (path[rl] && path[rl] != '/')) return IDX_NONE;
+        path += rl;
+    }
+    uint32_t d = 0;
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+        const char *end = strchrnul(path, '/');
+        uint32_t e = idx_lookup(ix, &ix->dirs[d], path, end - path);
+        if (e == IDX_NONE || ix->ents[e].child >= IDX_UNREAD) return IDX_NONE;
+        d = ix->ents[e].child;
+        path = end;
+    }
+    return d;
+}
+
+// The index with the deepest root that reaches path
+static Index *index_covering(const char *path, uint32_t *dir) {
+    index_load_all();
+    Index *best = NULL;
+    size_t best_len = 0;
+    for (Index *ix = indexes; ix; ix = ix->next) {
+        size_t rl = strlen(ix->root);
+        if (best && rl <= best_len) continue;
+        uint32_t d = index_find_dir(ix, path);
+        if (d == IDX_NONE) continue;
+        best = ix;
+        best_len = rl;
+        *dir = d;
+    }
+    return best;
+}
+
+static inline uint32_t tri_at(const char *s) {
+    return (uint32_t)fold_ascii(s[0]) << 16 | (uint32_t)fold_ascii(s[1]) << 8 | fold_ascii(s[2]);
+}
+
+static const IdxTri *tri_find(const Index *ix, uint32_t tri) {
+    uint32_t lo = 0, hi = ix->h->n_tris;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ix->tris[mid].tri == tri) return &ix->tris[mid];
+        if (ix->tris[mid].tri < tri) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// Decodes a posting list into out; 0 if it is damaged
+static int tri_decode(const Index *ix, const IdxTri *t, uint32_t *out) {
+    const uint8_t *p = ix->post + t->off, *end = ix->post + ix->h->post_len;
+    uint32_t cur = 0;
+    for (uint32_t k = 0; k < t->count; k++) {
+        uint32_t v = 0;
+        int shift = 0;
+        do {
+            if (p >= end || shift > 28) return 0;
+            v |= (uint32_t)(*p & 0x7f) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        cur += v;
+        if (cur >= ix->h->n_ents) return 0;
+        out[k] = cur;
+    }
+    return 1;
+}
+
+// Longest run of a glob without wildcards; a plain pattern is all literal
+static size_t query_literal(const char *pat, int glob, char *lit) {
+    size_t best = 0, best_at = 0, run = 0, k = 0;
+    for (; pat[k]; k++) {
+        if (glob && pat[k] == '[') {
+            // A bracket expression matches one unknown character
+            size_t j = k + 1;
+            if (pat[j] == '!' || pat[j] == '^') j++;
+            if (pat[j] == ']') j++;
+            while (pat[j] && pat[j] != ']') j++;
+            if (pat[j]) k = j;
+            run = 0;
+            continue;
+        }
+        if (glob && strchr("*?\\", pat[k])) {
+            run = 0;
+            continue;
+        }
+        if (++run > best) { best = run; best_at = k + 1 - run; }
+    }
+    for (size_t j = 0; j < best; j++) lit[j] = fold_ascii(pat[best_at + j]);
+    lit[best] = '\0';
+    return best;
+}
+
+// Candidate entries containing every trigram of lit; NULL with *n = 0
+// when some trigram is absent, NULL with *n = -1 when nothing narrows
+static uint32_t *index_candidates(const Index *ix, const char *lit, size_t llen, long *n) {
+    *n = -1;
+    if (llen < 3) return NULL;
+    const IdxTri *lists[MAX_FILTER_LEN];
+    int nl = 0;
+    for (size_t k = 0; k + 3 <= llen; k++) {
+        const IdxTri *t = tri_find(ix, tri_at(lit + k));
+        if (!t) { *n = 0; return NULL; }
+        int dup = 0;
+        for (int j = 0; j < nl && !dup; j++) dup = lists[j] == t;
+        if (dup) continue;
+        // Shortest list first
+        int j = nl++;
+        for (; j > 0 && lists[j - 1]->count > t->count; j--) lists[j] = lists[j - 1];
+        lists[j] = t;
+    }
+    uint32_t *cand = malloc(sizeof(uint32_t) * (lists[0]->count + 1));
+    uint32_t *tmp = nl > 1 ? malloc(sizeof(uint32_t) * (lists[nl - 1]->count + 1)) : NULL;
+    if (!cand || (nl > 1 && !tmp) || !tri_decode(ix, lists[0], cand)) { free(cand); free(tmp); return NULL; }
+    long nc = lists[0]->count;
+    for (int j = 1; j < nl && nc > 0; j++) {
+        if (!tri_decode(ix, lists[j], tmp)) { nc = 0; break; }
+        long out = 0;
+        for (long a = 0, b = 0; a < nc && b < lists[j]->count;) {
+            if (cand[a] < tmp[b]) a++;
+            else if (cand[a] > tmp[b]) b++;
+            else { cand[out++] = cand[a]; a++; b++; }
+        }
+        nc = out;
+    }
+    free(tmp);
+    *n = nc;
+    return cand;
+}
+
+// Path of entry e below directory scope, or -1 if it lies elsewhere or too deep
+static int index_path(const Index *ix, uint32_t e, uint32_t scope, char *buf, size_t size) {
+    uint32_t comp[MAX_PATH / 2];
+    int nc = 0;
+    comp[nc++] = e;
+    for (uint32_t d = idx_dir_of(ix, e); d != scope; d = ix->dirs[d].parent) {
+        if (d == 0 || nc == MAX_PATH / 2) return -1;
+        comp[nc++] = ix->dirs[d].ent;
+    }
+    if (search_depth && nc > search_depth) return -1;
+    size_t len = 0;
+    for (int k = nc - 1; k >= 0; k--) {
+        size_t l = idx_name_len(ix, comp[k]);
+        if (len + l + 2 > size) return -1;
+        if (len) buf[len++] = '/';
+        memcpy(buf + len, ix->names + ix->ents[comp[k]].name_off, l);
+        len += l;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+int index_refresh(const char *path);
+
+// Fills the emptied listing from the index; refreshes the index in the
+// background when it is older than IDX_STALE_S
+static void index_search(Index *ix, uint32_t scope, const char *pattern) {
+    double t0 = now_ms();
+    int glob = strpbrk(pattern, "*?[") != NULL;
+    char lit[MAX_FILTER_LEN], path[MAX_PATH];
+    size_t llen = query_literal(pattern, glob, lit);
+    long n;
+    uint32_t *cand = index_candidates(ix, lit, llen, &n);
+    if (n < 0) n = ix->h->n_ents;
+    for (long k = 0; k < n; k++) {
+        uint32_t e = cand ? cand[k] : (uint32_t)k;
+        const char *name = ix->names + ix->ents[e].name_off;
+        size_t len = idx_name_len(ix, e);
+        if (glob ? fnmatch(pattern, name, FNM_CASEFOLD) != 0 : len < llen || !ci_find(name, len, lit, llen)) continue;
+        int plen = index_path(ix, e, scope, path, sizeof(path));
+        if (plen >= 0 && store_push(&app.st, path, plen, ix->ents[e].child != IDX_NONE ? ENT_DIR : 0) < 0) break;
+    }
+    free(cand);
+    app.load_ms = now_ms() - t0;
+    resort_listing(0);
+    
+    long age = (long)(time(NULL) - ix->h->built);
+    if (age > IDX_STALE_S && !app.index_job) index_refresh(app.current_dir);
+    status_info("%d sonuc | index %s, %ld dk once | %.1f ms", app.st.count, ix->root, age / 60, app.load_ms);
+    du_start();
+}
+
+// INDEX BUILDER
+typedef struct IdxNode {
+    struct IndexJob *job;
+    struct IdxNode *parent;
+    const char *name;               // in the parent's store
+    int fd, entered;
+    uint64_t ino;
+    int64_t mtime;
+    uint32_t old;                   // same directory in the previous file, or IDX_NONE
+    uint32_t id, first, ent;        // assigned when written
+    EntryStore ents;                // sorted by name
+    struct IdxNode **kids;          // parallel to ents; NULL unless entered below
+    atomic_int refs;
+} IdxNode;
+
+typedef struct IndexJob {
+    Pool *pool;
+    atomic_int cancel, refs;
+    unsigned gen;
+    char *root, *file;
+    Index *old;
+    uint64_t dev;
+    SkipList skip;
+    IdxNode *top;
+    atomic_long dirs, reread;
+} IndexJob;
+
+typedef struct {
+    char *root, *file;
+    int err;
+    long dirs, reread, ents;
+    double elapsed_ms;
+} IndexResult;
+
+typedef struct {
+    uint32_t tri, count, last;      // last: newest entry + 1
+    uint32_t len, cap;
+    uint8_t *buf;
+} TriList;
+
+typedef struct {
+    TriList *slot;
+    size_t cap, used;
+} TriTable;
+
+typedef struct {
+    int fd;
+    off_t off;
+    size_t n;
+    int err;
+    char buf[IDX_WBUF];
+} IdxWriter;
+
+void index_job_release(IndexJob *job) {
+    if (atomic_fetch_sub(&job->refs, 1) != 1) return;
+    free(job->root);
+    free(job->file);
+    free(job);
+}
+
+// Closes a directory once its task and every task below it are done
+static void idx_node_release(IdxNode *n) {
+    while (n && atomic_fetch_sub(&n->refs, 1) == 1) {
+        if (n->fd >= 0) close(n->fd);
+        n->fd = -1;
+        n = n->parent;
+    }
+}
+
+static void idx_free(IdxNode *top) {
+    IdxNode **stack = NULL;
+    size_t n = 0, cap = 0;
+    IdxNode *cur = top;
+    while (cur) {
+        for (int i = 0; cur->kids && i < cur->ents.count; i++) {
+            if (!cur->kids[i]) continue;
+            if (n == cap) {
+                size_t nc = cap ? cap * 2 : 256;
+                IdxNode **ns = realloc(stack, sizeof(IdxNode *) * nc);
+                if (!ns) break;     // leaks the rest rather than crash
+                stack = ns;
+                cap = nc;
+            }
+            stack[n++] = cur->kids[i];
+        }
+        store_free(&cur->ents);
+        free(cur->kids);
+        free(cur);
+        cur = n ? stack[--n] : NULL;
+    }
+    free(stack);
+}
+
+static int idx_name_cmp(const void *a, const void *b, void *ctx) {
+    const EntryStore *st = ctx;
+    return strcmp(st->names + st->name_off[*(const int *)a], st->names + st->name_off[*(const int *)b]);
+}
+
+// Reads a changed directory into n->ents in name order; 0 on failure
+static int idx_read_dir(IdxNode *n) {
+    EntryStore tmp = {0};
+    char *buf = malloc(DENTS_FIRST_BUF);
+    int ok = buf != NULL;
+    long nread;
+    while (ok && (nread = syscall(SYS_getdents64, n->fd, buf, DENTS_FIRST_BUF)) > 0) {
+        for (long off = 0; off < nread;) {
+            struct linux_dirent64 *de = (struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            const char *name = de->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            int is_dir = de->d_type == DT_DIR;
+            if (de->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(n->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+            if (store_push(&tmp, name, strlen(name), is_dir ? ENT_DIR : 0) < 0) { ok = 0; break; }
+        }
+    }
+    if (ok && nread < 0) ok = 0;
+    free(buf);
+    int *ord = ok ? malloc(sizeof(int) * (tmp.count + 1)) : NULL;
+    if (ord) {
+        for (int i = 0; i < tmp.count; i++) ord[i] = i;
+        qsort_r(ord, tmp.count, sizeof(int), idx_name_cmp, &tmp);
+        for (int k = 0; k < tmp.count && ok; k++) {
+            int i = ord[k];
+            ok = store_push(&n->ents, tmp.names + tmp.name_off[i], tmp.name_len[i], tmp.flags[i]) >= 0;
+        }
+    }
+    free(ord);
+    store_free(&tmp);
+    return ord != NULL && ok;
+}
+
+// arg is an IdxNode with refs == 1; each subdirectory queued holds a
+// reference, which keeps this fd open for its openat()
+static void idx_dir_run(Pool *pool, void *arg) {
+    IdxNode *n = arg;
+    IndexJob *job = n->job;
+    const Index *old = job->old;
+    if (atomic_load(&job->cancel)) { idx_node_release(n); return; }
+    n->fd = n->parent ? openat(n->parent->fd, n->name, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW)
+                      : open(job->root, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    struct stat st;
+    if (n->fd < 0 || fstat(n->fd, &st) < 0 || (uint64_t)st.st_dev != job->dev) { idx_node_release(n); return; }
+    n->ino = st.st_ino;
+    n->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    atomic_fetch_add(&job->dirs, 1);
+    
+    const IdxDir *od = old && n->old != IDX_NONE ? &old->dirs[n->old] : NULL;
+    int reuse = od && od->ino == n->ino && od->mtime == n->mtime;
+    if (reuse) {
+        // Unchanged since the last build: its entries are still right
+        for (uint32_t e = od->first; e < od->first + od->count && reuse; e++) {
+            int flags = old->ents[e].child != IDX_NONE ? ENT_DIR : 0;
+            reuse = store_push(&n->ents, old->names + old->ents[e].name_off, idx_name_len(old, e), flags) >= 0;
+        }
+        if (!reuse) store_free(&n->ents);
+    }
+    if (!reuse) {
+        atomic_fetch_add(&job->reread, 1);
+        if (!idx_read_dir(n)) { store_free(&n->ents); idx_node_release(n); return; }
+    }
+    n->entered = 1;
+    
+    n->kids = calloc(n->ents.count + 1, sizeof(IdxNode *));
+    for (int i = 0; n->kids && i < n->ents.count; i++) {
+        const char *name = n->ents.names + n->ents.name_off[i];
+        if (!(n->ents.flags[i] & ENT_DIR) || skip_match(&job->skip, name)) continue;
+        IdxNode *c = calloc(1, sizeof(IdxNode));
+        if (!c) break;
+        c->job = job;
+        c->parent = n;
+        c->name = name;
+        c->fd = -1;
+        uint32_t e = !od ? IDX_NONE : reuse ? od->first + i : idx_lookup(old, od, name, n->ents.name_len[i]);
+        c->old = e != IDX_NONE && old->ents[e].child < IDX_UNREAD ? old->ents[e].child : IDX_NONE;
+        atomic_init(&c->refs, 1);
+        atomic_fetch_add(&n->refs, 1);
+        n->kids[i] = c;
+        pool_submit(pool, idx_dir_run, c);
+    }
+    idx_node_release(n);
+}
+
+static TriList *tri_slot(TriTable *t, uint32_t tri) {
+    if ((t->used + 1) * 2 > t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        TriList *ns = calloc(cap, sizeof(TriList));
+        if (!ns) return NULL;
+        for (size_t k = 0; k < t->cap; k++) {
+            if (!t->slot[k].tri) continue;
+            size_t h = (t->slot[k].tri * 0x9e3779b1u) & (cap - 1);
+            while (ns[h].tri) h = (h + 1) & (cap - 1);
+            ns[h] = t->slot[k];
+        }
+        free(t->slot);
+        t->slot = ns;
+        t->cap = cap;
+    }
+    size_t h = (tri * 0x9e3779b1u) & (t->cap - 1);
+    while (t->slot[h].tri && t->slot[h].tri != tri) h = (h + 1) & (t->cap - 1);
+    if (!t->slot[h].tri) {
+        t->slot[h].tri = tri;
+        t->used++;
+    }
+    return &t->slot[h];
+}
+
+// Appends entry id to every trigram list of name, once per list
+static int tri_add_name(TriTable *t, const char *name, size_t len, uint32_t id) {
+    for (size_t k = 0; k + 3 <= len; k++) {
+        TriList *l = tri_slot(t, tri_at(name + k));
+        if (!l) return 0;
+        if (l->last == id + 1) continue;
+        if (l->len + 5 > l->cap) {
+            uint32_t cap = l->cap ? l->cap * 2 : 16;
+            uint8_t *nb = realloc(l->buf, cap);
+            if (!nb) return 0;
+            l->buf = nb;
+            l->cap = cap;
+        }
+        uint32_t v = id - (l->last ? l->last - 1 : 0);
+        for (; v >= 0x80; v >>= 7) l->buf[l->len++] = (uint8_t)(v | 0x80);
+        l->buf[l->len++] = (uint8_t)v;
+        l->count++;
+        l->last = id + 1;
+    }
+    return 1;
+}
+
+static int tri_cmp(const void *a, const void *b) {
+    uint32_t x = (*(TriList *const *)a)->tri, y = (*(TriList *const *)b)->tri;
+    return x < y ? -1 : x > y;
+}
+
+static void iw_flush(IdxWriter *w) {
+    for (size_t done = 0; done < w->n && !w->err;) {
+        ssize_t r = pwrite(w->fd, w->buf + done, w->n - done, w->off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) { w->err = r < 0 ? errno : EIO; break; }
+        done += r;
+        w->off += r;
+    }
+    w->n = 0;
+}
+
+static void iw_put(IdxWriter *w, const void *p, size_t n) {
+    while (n && !w->err) {
+        size_t k = IDX_WBUF - w->n < n ? IDX_WBUF - w->n : n;
+        memcpy(w->buf + w->n, p, k);
+        w->n += k;
+        p = (const char *)p + k;
+        n -= k;
+        if (w->n == IDX_WBUF) iw_flush(w);
+    }
+}
+
+static IdxWriter *iw_open(int fd, off_t off) {
+    IdxWriter *w = malloc(sizeof(IdxWriter));
+    if (w) *w = (IdxWriter){fd, off, 0, 0};
+    return w;
+}
+
+static inline uint64_t align8(uint64_t v) {
+    return (v + 7) & ~7ULL;
+}
+
+// Numbers the entered directories breadth-first and writes the file next
+// to the old one, then renames it into place; returns an errno
+static int index_write(IndexJob *job, IndexResult *r) {
+    if (!job->top->entered) return EACCES;
+    IdxNode **q = malloc(sizeof(IdxNode *) * 1024);
+    size_t qn = 0, qcap = 1024;
+    if (!q) return ENOMEM;
+    q[qn++] = job->top;
+    uint64_t n_ents = 0, names_len = 0;
+    for (size_t qi = 0; qi < qn; qi++) {
+        IdxNode *n = q[qi];
+        n->id = qi;
+        n->first = n_ents;
+        n_ents += n->ents.count;
+        names_len += n->ents.names_len;
+        for (int i = 0; i < n->ents.count; i++) {
+            if (!n->kids || !n->kids[i] || !n->kids[i]->entered) continue;
+            if (qn == qcap) {
+                IdxNode **nq = realloc(q, sizeof(IdxNode *) * qcap * 2);
+                if (!nq) { free(q); return ENOMEM; }
+                q = nq;
+                qcap *= 2;
+            }
+            n->kids[i]->ent = n->first + i;
+            q[qn++] = n->kids[i];
+        }
+    }
+    if (n_ents >= IDX_UNREAD || qn >= IDX_UNREAD || names_len >= UINT32_MAX) { free(q); return EFBIG; }
+    
+    IdxHeader h = {IDX_MAGIC, IDX_VERSION, sizeof(IdxHeader)};
+    h.built = time(NULL);
+    h.n_dirs = qn;
+    h.n_ents = n_ents;
+    h.root_len = strlen(job->root);
+    h.root_off = sizeof(IdxHeader);
+    h.dirs_off = align8(h.root_off + h.root_len + 1);
+    h.ents_off = h.dirs_off + sizeof(IdxDir) * qn;
+    h.names_off = h.ents_off + sizeof(IdxEnt) * n_ents;
+    h.names_len = names_len;
+    h.tris_off = align8(h.names_off + names_len + ARENA_PAD);
+    
+    char tmp[MAX_PATH];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", job->file);
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+    if (fd < 0) { free(q); return errno; }
+    IdxWriter *wd = iw_open(fd, h.dirs_off), *we = iw_open(fd, h.ents_off), *wn = iw_open(fd, h.names_off);
+    TriTable tt = {0};
+    int err = !wd || !we || !wn ? ENOMEM : 0;
+    if (!err && pwrite(fd, job->root, h.root_len + 1, h.root_off) != (ssize_t)h.root_len + 1) err = errno ? errno : EIO;
+    
+    uint32_t name_off = 0, id = 0;
+    for (size_t qi = 0; qi < qn && !err; qi++) {
+        IdxNode *n = q[qi];
+        IdxDir d = {n->parent ? n->parent->id : IDX_NONE, n->parent ? n->ent : IDX_NONE, n->first, n->ents.count, n->ino, n->mtime};
+        iw_put(wd, &d, sizeof(d));
+        for (int i = 0; i < n->ents.count && !err; i++, id++) {
+            IdxNode *k = n->kids ? n->kids[i] : NULL;
+            IdxEnt e = {name_off, k && k->entered ? k->id : (n->ents.flags[i] & ENT_DIR) ? IDX_UNREAD : IDX_NONE};
+            const char *name = n->ents.names + n->ents.name_off[i];
+            iw_put(we, &e, sizeof(e));
+            iw_put(wn, name, n->ents.name_len[i] + 1);
+            name_off += n->ents.name_len[i] + 1;
+            if (!tri_add_name(&tt, name, n->ents.name_len[i], id)) err = ENOMEM;
+        }
+        if (!err) err = wd->err ? wd->err : we->err ? we->err : wn->err;
+    }
+    free(q);
+    static const char pad[ARENA_PAD];
+    if (!err) iw_put(wn, pad, ARENA_PAD);
+    
+    TriList **tl = err ? NULL : malloc(sizeof(TriList *) * (tt.used + 1));
+    if (!err && !tl) err = ENOMEM;
+    if (!err) {
+        size_t nt = 0;
+        for (size_t k = 0; k < tt.cap; k++) if (tt.slot[k].tri) tl[nt++] = &tt.slot[k];
+        qsort(tl, nt, sizeof(TriList *), tri_cmp);
+        h.n_tris = nt;
+        h.post_off = h.tris_off + sizeof(IdxTri) * nt;
+        IdxWriter *wt = iw_open(fd, h.tris_off), *wp = iw_open(fd, h.post_off);
+        if (!wt || !wp) err = ENOMEM;
+        for (size_t k = 0; k < nt && !err; k++) {
+            IdxTri t = {tl[k]->tri, tl[k]->count, h.post_len};
+            iw_put(wt, &t, sizeof(t));
+            iw_put(wp, tl[k]->buf, tl[k]->len);
+            h.post_len += tl[k]->len;
+        }
+        if (!err) { iw_flush(wt); iw_flush(wp); err = wt->err ? wt->err : wp->err; }
+        free(wt);
+        free(wp);
+    }
+    free(tl);
+    for (size_t k = 0; k < tt.cap; k++) free(tt.slot[k].buf);
+    free(tt.slot);
+    if (!err) {
+        iw_flush(wd);
+        iw_flush(we);
+        iw_flush(wn);
+        err = wd->err ? wd->err : we->err ? we->err : wn->err;
+    }
+    free(wd);
+    free(we);
+    free(wn);
+    
+    h.file_size = h.post_off + h.post_len;
+    if (!err && (ftruncate(fd, h.file_size) < 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))) err = errno ? errno : EIO;
+    if (close(fd) < 0 && !err) err = errno;
+    if (!err && rename(tmp, job->file) < 0) err = errno;
+    if (err) unlink(tmp);
+    r->dirs = qn;
+    r->ents = n_ents;
+    return err;
+}
+
+static void *index_worker(void *p) {
+    IndexJob *job = p;
+    double t0 = now_ms();
+    IndexResult *r = calloc(1, sizeof(IndexResult));
+    job->old = index_open(job->file);
+    if (job->old && strcmp(job->old->root, job->root) != 0) {
+        index_close(job->old);
+        job->old = NULL;
+    }
+    struct stat st;
+    int err = stat(job->root, &st) < 0 ? errno : 0;
+    job->dev = st.st_dev;
+    job->top = err ? NULL : calloc(1, sizeof(IdxNode));
+    job->pool = job->top ? pool_create(copy_worker_count()) : NULL;
+    if (job->pool) {
+        *job->top = (IdxNode){job, NULL, "", -1, 0, 0, 0, job->old ? 0 : IDX_NONE};
+        atomic_init(&job->top->refs, 1);
+        pool_submit(job->pool, idx_dir_run, job->top);
+        pool_wait(job->pool, -1);
+        pool_destroy(job->pool);
+    } else if (!err) {
+        err = ENOMEM;
+    }
+    if (!err && !atomic_load(&job->cancel) && r) err = index_write(job, r);
+    if (job->top) idx_free(job->top);
+    index_close(job->old);
+    
+    if (r && !atomic_load(&job->cancel)) {
+        r->root = strdup(job->root);
+        r->file = strdup(job->file);
+        r->err = err ? err : !r->root || !r->file ? ENOMEM : 0;
+        r->reread = atomic_load(&job->reread);
+        r->elapsed_ms = now_ms() - t0;
+        post_event(EV_INDEX_DONE, job->gen, r);
+    } else {
+        free(r);
+    }
+    index_job_release(job);
+    return NULL;
+}
+
+void index_cancel() {
+    index_gen++;
+    if (!app.index_job) return;
+    atomic_store(&app.index_job->cancel, 1);
+    index_job_release(app.index_job);
+    app.index_job = NULL;
+}
+
+// Builds or refreshes in the background the index covering path, or a new
+// one rooted at path when none does
+int index_refresh(const char *path) {
+    if (app.index_job) { status_info("Index zaten guncelleniyor"); return 0; }
+    uint32_t d;
+    Index *ix = index_covering(path, &d);
+    IndexJob *job = calloc(1, sizeof(IndexJob));
+    char file[MAX_PATH];
+    if (!job || !index_file_for(ix ? ix->root : path, file, sizeof(file)) ||
+        !(job->root = strdup(ix ? ix->root : path)) || !(job->file = strdup(file))) {
+        if (job) { free(job->root); free(job); }
+        status_error("Index dosyasi olusturulamadi");
+        return 0;
+    }
+    skip_init(&job->skip, search_skip);
+    job->gen = ++index_gen;
+    atomic_init(&job->cancel, 0);
+    atomic_init(&job->refs, 2);
+    atomic_init(&job->dirs, 0);
+    atomic_init(&job->reread, 0);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, index_worker, job) != 0) {
+        index_job_release(job);
+        index_job_release(job);
+        status_error("Index baslatilamadi");
+        return 0;
+    }
+    pthread_detach(tid);
+    app.index_job = job;
+    status_info("Index olusturuluyor: %s", job->root);
+    return 1;
+}
+
+// Maps a finished build in place of the old one; returns 1 if the UI changed
+int index_merge(Event *ev) {
+    IndexResult *r = ev->data;
+    if (ev->gen == index_gen) {
+        if (app.index_job) index_job_release(app.index_job);
+        app.index_job = NULL;
+        Index *nx = r->err ? NULL : index_open(r->file);
+        if (nx) {
+            index_load_all();
+            for (Index **pp = &indexes; *pp; pp = &(*pp)->next) {
+                if (strcmp((*pp)->root, nx->root) == 0) {
+                    Index *dead = *pp;
+                    *pp = dead->next;
+                    index_close(dead);
+                    break;
+                }
+            }
+            nx->next = indexes;
+            indexes = nx;
+            status_info("Index %s | %ld dizin (%ld okundu), %ld girdi | %.0f ms", r->root, r->dirs, r->reread, r->ents, r->elapsed_ms);
+        } else {
+            status_error("Index olusturulamadi: %s", strerror(r->err ? r->err : EINVAL));
+        }
+    }
+    free(r->root);
+    free(r->file);
+    free(r);
+    return 1;
+}
+
+// SHARED CLIPBOARD
+// An append-only log of full paths in a file that every drmngr of the user
+// maps, $XDG_RUNTIME_DIR/drmngr-clipboard (else in the cache directory), so
+// a copy in one instance is pasted from the same pages in another. Records
+// are never rewritten: a clear bumps the epoch and rewinds the log, and the
+// file only grows, so no instance's mapping ends past EOF. flock() orders
+// writers against readers. Each instance indexes the log in a private table
+// keyed by the path hash stored in each record, rebuilt when the epoch
+// changes and extended as the log grows, so a duplicate costs one lookup.
+// Without a usable file the log lives in private memory.
+#define CLIP_MAGIC "DRMCLIP\n"
+#define CLIP_VERSION 1
+#define CLIP_MIN_SIZE (64 * 1024)
+
+typedef struct {
+    char magic[8];
+    uint32_t version, header_size;
+    uint32_t epoch;
+    uint32_t count;
+    uint32_t cut;
+    uint32_t pad;
+    uint64_t log_len;
+} ClipHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t len;       // the path and a NUL follow, padded to 8 bytes
+    uint32_t flags;     // ENT_DIR
+} ClipRec;
+
+typedef struct {
+    int fd;
+    char *map;
+    size_t size;
+    uint32_t epoch;
+    uint64_t seen;      // log bytes indexed
+    uint64_t *rec;      // record offsets in log order
+    int n, cap;
+    uint32_t *table;    // record number + 1, by path hash
+    size_t tcap;
+} Clipboard;
+
+Clipboard clip = {-1};
+
+#define CLIP_HDR() ((ClipHeader *)clip.map)
+#define CLIP_REC(off) ((ClipRec *)(clip.map + sizeof(ClipHeader) + (off)))
+
+static inline uint64_t clip_rec_size(uint32_t len) {
+    return (sizeof(ClipRec) + len + 1 + 7) & ~7ULL;
+}
+
+static int clip_lock(int op) {
+    while (clip.fd >= 0 && flock(clip.fd, op) < 0) {
+        if (errno != EINTR) return 0;
+    }
+    return 1;
+}
+
+static void clip_unlock() {
+    if (clip.fd >= 0) flock(clip.fd, LOCK_UN);
+}
+
+// Maps at least size bytes, growing the file if it is shorter
+static int clip_map(size_t size) {
+    if (clip.fd >= 0) {
+        struct stat st;
+        if (fstat(clip.fd, &st) < 0) return 0;
+        if ((size_t)st.st_size < size && ftruncate(clip.fd, size) < 0) return 0;
+        if ((size_t)st.st_size > size) size = st.st_size;
+    }
+    if (clip.map && size == clip.size) return 1;
+    char *m = clip.map ? mremap(clip.map, clip.size, size, MREMAP_MAYMOVE)
+                       : mmap(NULL, size, PROT_READ|PROT_WRITE, clip.fd >= 0 ? MAP_SHARED : MAP_PRIVATE|MAP_ANONYMOUS, clip.fd, 0);
+    if (m == MAP_FAILED) return 0;
+    clip.map = m;
+    clip.size = size;
+    return 1;
+}
+
+static int clip_open() {
+    if (clip.map) return 1;
+    char path[MAX_PATH];
+    const char *run = getenv("XDG_RUNTIME_DIR");
+    if (run && run[0]) snprintf(path, sizeof(path), "%s/drmngr-clipboard", run);
+    else if (index_dir(path, sizeof(path) - 16)) strcat(path, "/clipboard");
+    else path[0] = '\0';
+    clip.fd = path[0] ? open(path, O_RDWR|O_CREAT|O_CLOEXEC|O_NOFOLLOW, 0600) : -1;
+    if (clip.fd >= 0 && (!clip_lock(LOCK_EX) || !clip_map(CLIP_MIN_SIZE))) {
+        close(clip.fd);
+        clip.fd = -1;
+    }
+    if (clip.fd < 0 && !clip_map(CLIP_MIN_SIZE)) return 0;
+    
+    ClipHeader *h = CLIP_HDR();
+    if (memcmp(h->magic, CLIP_MAGIC, 8) || h->version != CLIP_VERSION || h->header_size != sizeof(ClipHeader) ||
+        h->log_len > clip.size - sizeof(ClipHeader)) {
+        memset(h, 0, sizeof(ClipHeader));
+        memcpy(h->magic, CLIP_MAGIC, 8);
+        h->version = CLIP_VERSION;
+        h->header_size = sizeof(ClipHeader);
+    }
+    // Differs from the file, so the first sync indexes the whole log
+    clip.epoch = h->epoch + 1;
+    clip_unlock();
+    return 1;
+}
+
+void clip_close() {
+    if (clip.map) munmap(clip.map, clip.size);
+    if (clip.fd >= 0) close(clip.fd);
+    free(clip.rec);
+    free(clip.table);
+    clip = (Clipboard){-1};
+}
+
+static int clip_index(uint64_t off, uint64_t hash) {
+    if (clip.n == clip.cap) {
+        int cap = clip.cap ? clip.cap * 2 : 1024;
+        uint64_t *rec = realloc(clip.rec, sizeof(uint64_t) * cap);
+        if (!rec) return 0;
+        clip.rec = rec;
+        clip.cap = cap;
+    }
+    if ((size_t)(clip.n + 1) * 2 > clip.tcap) {
+        size_t tcap = clip.tcap ? clip.tcap * 2 : 2048;
+        uint32_t *t = calloc(tcap, sizeof(uint32_t));
+        if (!t) return 0;
+        for (int i = 0; i < clip.n; i++) {
+            size_t k = CLIP_REC(clip.rec[i])->hash & (tcap - 1);
+            while (t[k]) k = (k + 1) & (tcap - 1);
+            t[k] = i + 1;
+        }
+        free(clip.table);
+        clip.table = t;
+        clip.tcap = tcap;
+    }
+    size_t k = hash & (clip.tcap - 1);
+    while (clip.table[k]) k = (k + 1) & (clip.tcap - 1);
+    clip.table[k] = clip.n + 1;
+    clip.rec[clip.n++] = off;
+    return 1;
+}
+
+static int clip_find(const char *path, size_t len, uint64_t hash) {
+    if (!clip.tcap) return 0;
+    for (size_t k = hash & (clip.tcap - 1); clip.table[k]; k = (k + 1) & (clip.tcap - 1)) {
+        const ClipRec *r = CLIP_REC(clip.rec[clip.table[k] - 1]);
+        if (r->hash == hash && r->len == len && memcmp(r + 1, path, len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Brings the private index up to date with the log; called under the lock
+static int clip_sync() {
+    ClipHeader *h = CLIP_HDR();
+    if (sizeof(ClipHeader) + h->log_len > clip.size) {
+        // Another instance grew the file
+        if (!clip_map(clip.size)) return 0;
+        h = CLIP_HDR();
+        if (sizeof(ClipHeader) + h->log_len > clip.size) return 0;
+    }
+    if (h->epoch != clip.epoch || h->log_len < clip.seen) {
+        clip.epoch = h->epoch;
+        clip.seen = 0;
+        clip.n = 0;
+        if (clip.table) memset(clip.table, 0, sizeof(uint32_t) * clip.tcap);
+    }
+    while (clip.seen + sizeof(ClipRec) <= h->log_len) {
+        const ClipRec *r = CLIP_REC(clip.seen);
+        uint64_t size = clip_rec_size(r->len);
+        if (size > h->log_len - clip.seen || !clip_index(clip.seen, r->hash)) return 0;
+        clip.seen += size;
+    }
+    return 1;
+}
+
+int clip_count() {
+    return clip_open() ? (int)CLIP_HDR()->count : 0;
+}
+
+int clip_is_cut() {
+    return clip_open() && CLIP_HDR()->cut;
+}
+
+// Adds full paths, skipping ones already held; a clipboard holding the
+// other mode is emptied first. Returns how many were added, -1 on failure.
+int clip_add(const EntryStore *paths, int cut) {
+    if (!clip_open() || !clip_lock(LOCK_EX)) return -1;
+    int added = clip_sync() ? 0 : -1;
+    ClipHeader *h = CLIP_HDR();
+    if (added == 0 && h->cut != (uint32_t)cut) {
+        h->epoch++;
+        h->count = 0;
+        h->log_len = 0;
+        h->cut = cut;
+        clip_sync();
+    }
+    for (int i = 0; added >= 0 && i < paths->count; i++) {
+        const char *path = paths->names + paths->name_off[i];
+        size_t len = paths->name_len[i];
+        uint64_t hash = fnv1a(path, len), size = clip_rec_size(len);
+        if (clip_find(path, len, hash)) continue;
+        if (sizeof(ClipHeader) + h->log_len + size > clip.size) {
+            size_t grow = clip.size * 2;
+            while (grow < sizeof(ClipHeader) + h->log_len + size) grow *= 2;
+            if (!clip_map(grow)) { added = -1; break; }
+            h = CLIP_HDR();
+        }
+        ClipRec *r = CLIP_REC(h->log_len);
+        *r = (ClipRec){hash, len, paths->flags[i] & ENT_DIR};
+        memcpy(r + 1, path, len);
+        memset((char *)(r + 1) + len, 0, size - sizeof(ClipRec) - len);
+        if (!clip_index(h->log_len, hash)) { added = -1; break; }
+        h->log_len += size;
+        h->count++;
+        clip.seen = h->log_len;
+        added++;
+    }
+    clip_unlock();
+    return added;
+}
+
+void clip_clear() {
+    if (!clip_open() || !clip_lock(LOCK_EX)) return;
+    ClipHeader *h = CLIP_HDR();
+    h->epoch++;
+    h->count = 0;
+    h->cut = 0;
+    h->log_len = 0;
+    clip_unlock();
+}
+
+// Copies the clipboard into out, names being full paths; returns 1 for a
+// cut, 0 for a copy, -1 on failure
+int clip_snapshot(EntryStore *out) {
+    if (!clip_open() || !clip_lock(LOCK_SH)) return -1;
+    int cut = clip_sync() ? (int)CLIP_HDR()->cut : -1;
+    for (int i = 0; cut >= 0 && i < clip.n; i++) {
+        const ClipRec *r = CLIP_REC(clip.rec[i]);
+        if (store_push(out, (const char *)(r + 1), r->len, r->flags & ENT_DIR) < 0) cut = -1;
+    }
+    clip_unlock();
+    return cut;
+}
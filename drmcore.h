@@ -0,0 +1,315 @@
+// DRMNGR core: listing, filter, sort, watch, cache, copy, delete and
+// directory-size engine. Nothing in here touches the terminal; the UI in
+// dirmanlinux.c and the benchmark in drmbench.c both link drmcore.c.
+#ifndef DRMCORE_H
+#define DRMCORE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/limits.h>
+
+#define MAX_PATH 4096
+#define PAGE_SIZE 100
+#define MAX_FILTER_LEN 256
+#define CACHE_MAX_DIRS 64
+#define CACHE_MEM_CAP ((size_t)256 << 20)
+
+// ENTRY STORE
+// Struct-of-arrays listing: names live back to back in one arena, the
+// remaining columns are indexed by entry number.
+#define ENT_DIR      0x01
+#define ENT_SELECTED 0x02
+#define ENT_VISIBLE  0x04
+#define ENT_STATTED  0x08
+#define ENT_RANKED   0x10
+#define ENT_DELETED  0x20
+
+typedef struct {
+    char *names;
+    size_t names_len;
+    size_t names_cap;
+    uint32_t *name_off;
+    uint16_t *name_len;     // search results are paths, so not capped at NAME_MAX
+    uint8_t *flags;
+    off_t *size;
+    int64_t *mtime;     // ns since the epoch, valid once ENT_STATTED
+    int count;
+    int cap;
+} EntryStore;
+
+typedef struct {
+    EntryStore st;
+    int *vis;           // entry indices of visible rows, in display order
+    int n_visible;
+    int vis_cap;
+    int highlight;      // position in vis, not an entry index
+    int page_start;
+    int page_count;
+    char current_dir[MAX_PATH];
+    char filter[MAX_FILTER_LEN];
+    char filter_lc[MAX_FILTER_LEN];
+    int filter_active;
+    int fuzzy;
+    int *match;         // fuzzy mode: current matches in directory order
+    int n_match;
+    int *flt_hist[MAX_FILTER_LEN];      // visible sets of shorter filter prefixes
+    int flt_hist_n[MAX_FILTER_LEN];
+    int flt_hist_cap[MAX_FILTER_LEN];
+    int flt_depth;
+    int select_count;
+    int dir_fd;
+    double load_ms;
+    double load_rate;
+    int loading;
+    unsigned load_gen;
+    struct LoadJob *load_job;
+    int inotify_fd;
+    int watch_wd;
+    int watch_pending;      // the watch is still being added on a worker
+    char loaded_dir[MAX_PATH];  // directory the store belongs to
+    dev_t dir_dev;
+    ino_t dir_ino;
+    struct timespec dir_mtime;  // taken before the scan, refreshed while watched
+    char *watch_backlog;    // raw events that arrived while the scan was still running
+    size_t watch_backlog_len;
+    int *name_index;        // open-addressed name -> entry table, built on demand
+    int name_index_cap;
+    int name_index_used;
+    int *order;             // entry indices in sort order; order_n == 0: store order
+    int order_n;
+    int order_cap;
+    uint64_t *name_key;     // natural sort keys of entries [0, name_key_n)
+    int name_key_n;
+    int *name_order;        // entries in natural name order, rebuilt when entries are added
+    int name_order_n;
+    long long *du;          // recursive directory sizes; -1 unknown, -2 unreadable
+    int du_n;
+    struct DuJob *du_job;
+    unsigned du_gen;
+    char search[MAX_FILTER_LEN];    // non-empty: the store holds subtree search results
+    int searching;
+    int search_content;             // the results are files whose contents matched
+    struct SearchJob *search_job;
+    char jump[NAME_MAX + 1];        // entry to put the cursor on once the listing is in
+    struct IndexJob *index_job;
+    int deleting;                   // a background delete is running
+} AppState;
+
+extern AppState app;
+extern char status_msg[256];
+extern int status_is_error;
+
+#define ENT_NAME(i) (app.st.names + app.st.name_off[i])
+#define ENT_IS(i, f) ((app.st.flags[i] & (f)) != 0)
+
+void status_error(const char *fmt, ...);
+void status_info(const char *fmt, ...);
+void status_clear();
+void* safe_malloc(size_t size, const char *ctx);
+void* safe_realloc(void *p, size_t size, const char *ctx);
+double now_ms();
+int cpu_count();
+
+// FILTER ENGINE
+void filter_engine_init();
+int fuzzy_score(const char *s, int n, const char *pat, int m);
+void apply_filter();
+void filter_narrow();
+void filter_widen();
+void filter_extend(int from);
+void filter_history_clear();
+int cur_index();
+void move_cursor(int pos);
+
+// DIRECTORY READER
+void store_free(EntryStore *st);
+int store_push(EntryStore *st, const char *name, size_t len, uint8_t flags);
+void stat_entry_at(EntryStore *st, int dir_fd, int i);
+void stat_entry(int i);
+
+// SORTING
+typedef enum {
+    SORT_NONE,
+    SORT_NAME,
+    SORT_SIZE,
+    SORT_MTIME,
+    SORT_EXT,
+    NUM_SORTS
+} SortMode;
+
+extern const char *sort_names[];
+extern int sort_mode, sort_dirs_first;
+
+int natural_cmp(const char *a, int la, const char *b, int lb);
+void sort_listing();
+void resort_listing(int keep_cursor);
+
+// EVENT QUEUE
+typedef enum {
+    EV_LOAD_BATCH,
+    EV_WATCH_READY,
+    EV_DU_SIZE,
+    EV_DU_DONE,
+    EV_SEARCH_BATCH,
+    EV_INDEX_DONE,
+    EV_DELETE_PROGRESS,
+    EV_DELETE_DONE
+} EventType;
+
+typedef struct Event {
+    EventType type;
+    unsigned gen;
+    void *data;
+    struct Event *next;
+} Event;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Event *head, *tail;
+    int wake_fd;        // readable while events are queued
+} EventQueue;
+
+extern EventQueue events;
+
+int events_init();
+int process_events();
+
+// LOADING, WATCH AND CACHE
+typedef struct {
+    struct CacheEntry *head, *tail;
+    int count;
+    size_t bytes;
+    unsigned long hits, misses;
+} DirCache;
+
+extern DirCache dir_cache;
+
+int load_directory();
+void load_cancel();
+int process_inotify();
+void refresh_listing();
+void name_index_free();
+void cache_clear();
+
+// COPY AND DELETE
+#define PROGRESS_MS 100
+#define COPY_MOVE 1
+#define COPY_VERIFY 2
+#define COPY_PRESERVE 4
+
+typedef struct {
+    long long bytes, total_bytes;
+    long files, total_files, dirs, errors;
+    long verified, mismatched;     // COPY_VERIFY: files read back identical / not
+    int measuring;
+    double seconds, bytes_per_sec, files_per_sec, eta;  // eta < 0: unknown
+    char current[256];
+} CopyStats;
+
+typedef void (*progress_fn)(const CopyStats *cs);
+
+typedef struct {
+    long removed, errors;
+    double seconds, per_sec;
+    char current[256];
+} RemoveStats;
+
+typedef void (*remove_progress_fn)(const RemoveStats *rs);
+
+typedef struct {
+    uint64_t v[4], total;
+    uint8_t tail[32];
+    size_t n;
+} Xxh64;
+
+extern int copy_workers;
+extern int copy_verify;
+
+int copy_worker_count();
+int copy_file(const char *src, const char *dst);
+void xxh64_init(Xxh64 *h);
+void xxh64_update(Xxh64 *h, const void *data, size_t len);
+uint64_t xxh64_final(const Xxh64 *h);
+int verify_hash(int fd, off_t off, off_t len, char *buf, uint64_t *hash);
+int copy_tree(const char **src, const char **dst, int n, int flags, int *fail, CopyStats *stats, progress_fn progress, EntryStore *bad);
+int copy_dir_recursive(const char *src, const char *dst);
+int remove_tree(const char **paths, int n, int *fail, RemoveStats *stats, remove_progress_fn progress);
+int remove_recursive(const char *path);
+int delete_start(const EntryStore *items);
+
+// DIRECTORY SYNC
+#define SYNC_HASH 1     // files of the same size are compared by content, not mtime
+#define SYNC_DELETE 2   // entries only in the destination are removed
+
+typedef struct {
+    long added, changed, same, extra;   // files, links and other non-directories
+    long dirs_added, dirs_extra;
+    long long added_bytes, changed_bytes, extra_bytes, hashed_bytes;
+    long errors;
+    double seconds;
+} SyncStats;
+
+typedef void (*sync_progress_fn)(const SyncStats *ss);
+
+typedef struct {
+    int flags;
+    char src[MAX_PATH], dst[MAX_PATH];
+    SyncStats stats;
+    EntryStore copy;        // paths below the roots to copy; "" is the root itself
+    EntryStore replace;     // changed entries of another type, removed from the destination first
+    EntryStore extra;       // only in the destination; removed with SYNC_DELETE
+} SyncPlan;
+
+extern int sync_flags;
+
+int sync_plan(const char *src, const char *dst, int flags, SyncPlan *plan, sync_progress_fn progress);
+int sync_apply(SyncPlan *plan, int copy_flags, CopyStats *stats, progress_fn progress, EntryStore *bad);
+void sync_plan_free(SyncPlan *plan);
+
+// DIRECTORY SIZES
+extern int du_enabled;
+
+void du_start();
+void du_cancel();
+void du_toggle();
+
+// SUBTREE SEARCH
+#define SEARCH_SKIP_LEN 256
+
+extern int search_depth;
+extern char search_skip[SEARCH_SKIP_LEN];
+
+int search_start(const char *pattern);
+int grep_start(const char *pattern);
+void search_cancel();
+
+// FILENAME INDEX
+int index_refresh(const char *path);
+void index_cancel();
+int index_count();
+void index_close_all();
+
+// SHARED CLIPBOARD
+int clip_count();
+int clip_is_cut();
+int clip_add(const EntryStore *paths, int cut);
+void clip_clear();
+int clip_snapshot(EntryStore *out);
+void clip_close();
+
+#endif
@@ -5,7 +5,9 @@
 set -e
 
 APP_NAME="drmngr"
-SRC_FILE="dirmanlinux.c"
+SRC_FILES="dirmanlinux.c drmcore.c"
+BENCH_NAME="drmbench"
+BENCH_FILES="drmbench.c drmcore.c"
 INSTALL_DIR="/usr/bin"
 
 RED='\033[0;31m'
@@ -32,12 +34,14 @@ check_deps() {
 build() {
     print_info "Building $APP_NAME..."
     
-    if [ ! -f "$SRC_FILE" ]; then
-        print_error "Source file not found: $SRC_FILE"
-        exit 1
-    fi
+    for f in $SRC_FILES; do
+        if [ ! -f "$f" ]; then
+            print_error "Source file not found: $f"
+            exit 1
+        fi
+    done
     
-    gcc -o "$APP_NAME" "$SRC_FILE" -lncurses -Wall -O2 || {
+    gcc -o "$APP_NAME" $SRC_FILES -lncurses -pthread -Wall -O2 || {
         print_error "Build failed!"
         exit 1
     }
@@ -45,6 +49,19 @@ build() {
     print_status "Build successful"
 }
 
+# Headless benchmark, no ncurses needed; extra arguments go to drmbench.
+# Only the JSON goes to stdout, so the output can be redirected to a file.
+bench() {
+    print_info "Building $BENCH_NAME..." >&2
+    gcc -o "$BENCH_NAME" $BENCH_FILES -pthread -Wall -O2 || {
+        print_error "Build failed!" >&2
+        exit 1
+    }
+    print_status "Build successful" >&2
+    print_info "Running $BENCH_NAME $*..." >&2
+    "./$BENCH_NAME" "$@"
+}
+
 install_system() {
     print_info "Installing to $INSTALL_DIR..."
     
@@ -70,7 +87,7 @@ uninstall() {
 
 clean() {
     print_info "Cleaning..."
-    rm -f "$APP_NAME"
+    rm -f "$APP_NAME" "$BENCH_NAME"
     print_status "Cleaned"
 }
 
@@ -97,6 +114,10 @@ case "${1:-build}" in
         install_system
         test_run
         ;;
+    bench)
+        shift
+        bench "$@"
+        ;;
     clean)
         clean
         ;;